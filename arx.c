@@ -32,6 +32,7 @@ comments start with # and continue till end of line
 #include EXPAT_H
 #include "u.h"
 #include "m.h"
+#include "th.h"
 #include "s.h"
 #include "xmlc.h"
 #include "ht.h"
@@ -42,7 +43,7 @@ comments start with # and continue till end of line
 #include "er.h"
 #include "ary.h"
 
-extern int rn_notAllowed;
+extern TH_LOCAL int rn_notAllowed;
 
 /* rules */
 #define VALID 1
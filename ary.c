@@ -22,6 +22,10 @@ ary_isany p =
        (After p1 Empty) -> isanymixed p1
        (After p1 p2) -> isanymixed p1 && ary_isany p2
        _ -> False
+
+ary_isanyhead::Pattern->Bool
+ary_isanyhead (After p1 p2) = isanymixed p1
+ary_isanyhead _ = False
 */
 
 static int isanycont(int p) {
@@ -74,3 +78,7 @@ int ary_isany(int p) {
   if(!RN_P_IS(p,RN_P_AFTER)) return 0;
   rn_After(p,p1,p2); return isanymix(p1)&&(p2==rn_empty||ary_isany(p2));
 }
+
+int ary_isanyhead(int p) {
+  return RN_P_IS(p,RN_P_AFTER)&&isanymix(rn_pattern[p+1]);
+}
@@ -3,6 +3,9 @@
 #ifndef ARY_H
 #define ARY_H 1
 
+/* the rest of the document is any well-formed content */
 extern int ary_isany(int p);
+/* the content of the current element is any well-formed content */
+extern int ary_isanyhead(int p);
 
 #endif
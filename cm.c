@@ -0,0 +1,97 @@
+/* $Id$ */
+
+#include "m.h"
+#include "ht.h"
+#include "th.h"
+#include "ll.h"
+#include "cm.h"
+
+#define LEN_M CM_LEN_M
+#define PRIME_M CM_PRIME_M
+#define N_C CM_N_C
+
+/* chain c is chn[c]={table,head,first member,reference bit}, with head -1 for a free chain;
+ chn[N_C] is the key for lookups. Members are mb[i]={chain,pattern,next member of the chain};
+ mb[0] is the key for lookups, and 0 ends the lists, of members and of free records. */
+#define C_SIZE 4
+#define MB_SIZE 3
+
+static TH_LOCAL int (*chn)[C_SIZE],hand;
+static TH_LOCAL int (*mb)[MB_SIZE],len_mb,n_mb,free_mb;
+static TH_LOCAL struct hashtable ht_chn,ht_mb;
+
+static int hash_chn(int c) {return chn[c][1]*PRIME_M+chn[c][0];}
+static int equal_chn(int c1,int c2) {return chn[c1][0]==chn[c2][0]&&chn[c1][1]==chn[c2][1];}
+static int hash_mb(int i) {return (mb[i][1]*PRIME_M)^mb[i][0];}
+static int equal_mb(int i1,int i2) {return mb[i1][0]==mb[i2][0]&&mb[i1][1]==mb[i2][1];}
+
+static TH_LOCAL int initialized=0;
+void cm_init(void) {
+  if(!initialized) { int c; initialized=1;
+    chn=(int(*)[C_SIZE])m_alloc(N_C+1,sizeof(int[C_SIZE]));
+    for(c=0;c!=N_C;++c) chn[c][1]=-1;
+    mb=(int(*)[MB_SIZE])m_alloc(len_mb=LEN_M,sizeof(int[MB_SIZE]));
+    ht_init(&ht_chn,N_C,&hash_chn,&equal_chn);
+    ht_init(&ht_mb,LEN_M,&hash_mb,&equal_mb);
+    n_mb=1; free_mb=0; hand=0;
+  }
+}
+
+/* proportional to the number of members rather than to the size of the tables */
+static void drop(int c) {
+  int i,j;
+  ht_deli(&ht_chn,c);
+  for(i=chn[c][2];i;i=j) {j=mb[i][2]; ht_deli(&ht_mb,i); mb[i][2]=free_mb; free_mb=i;}
+  chn[c][1]=-1;
+}
+
+void cm_clear(int t) {
+  int c;
+  for(c=0;c!=N_C;++c) if(chn[c][1]!=-1&&chn[c][0]==t) drop(c);
+}
+
+int cm_find(int t,int head) {
+  int c;
+  chn[N_C][0]=t; chn[N_C][1]=head;
+  if((c=ht_get(&ht_chn,N_C))!=-1) chn[c][3]=1;
+  return c;
+}
+
+/* as in drv, the chain to reuse is chosen with the clock algorithm */
+int cm_new(int t,int head) {
+  int c;
+  for(c=0;c!=N_C&&chn[c][1]!=-1;++c);
+  if(c==N_C) {
+    for(;;) {
+      if(hand==N_C) hand=0;
+      if(!chn[hand][3]) break;
+      chn[hand++][3]=0;
+    }
+    drop(c=hand++);
+  }
+  chn[c][0]=t; chn[c][1]=head; chn[c][2]=0; chn[c][3]=1;
+  ht_put(&ht_chn,c);
+  return c;
+}
+
+int cm_has(int c,int p) {
+  mb[0][0]=c; mb[0][1]=p;
+  return ht_get(&ht_mb,0)!=-1;
+}
+
+void cm_add(int c,int p) {
+  int i;
+  if(cm_has(c,p)) return;
+  if(free_mb) {i=free_mb; free_mb=mb[i][2];} else {
+    i=n_mb++;
+    if(n_mb==len_mb) mb=(int(*)[MB_SIZE])m_stretch(mb,len_mb=2*n_mb,n_mb,sizeof(int[MB_SIZE]));
+  }
+  mb[i][0]=c; mb[i][1]=p; mb[i][2]=chn[c][2]; chn[c][2]=i;
+  ht_put(&ht_mb,i);
+}
+
+/* the patterns are hash-consed, and if the new head is indexed already, it is the same chain */
+void cm_move(int c,int head) {
+  if(cm_find(chn[c][0],head)!=-1) {drop(c); return;}
+  ht_deli(&ht_chn,c); chn[c][1]=head; ht_put(&ht_chn,c);
+}
@@ -0,0 +1,23 @@
+/* $Id$ */
+
+#ifndef CM_H
+#define CM_H 1
+
+/* the alternatives of long left-deep chains of choices, kept by the head of each chain,
+ so that an alternative is looked up in, or added to, a chain of k alternatives in
+ constant time rather than in O(k); rn and rx keep their chains here, each in its own
+ table t, and several chains stay indexed while they grow in turn. */
+
+#define CM_RN 0
+#define CM_RX 1
+
+extern void cm_init(void);
+extern void cm_clear(int t); /* forgets the chains of table t */
+
+extern int cm_find(int t,int head); /* the chain starting at head, or -1 */
+extern int cm_new(int t,int head); /* an empty chain, in place of the least recently used one if needed */
+extern int cm_has(int c,int p);
+extern void cm_add(int c,int p);
+extern void cm_move(int c,int head); /* the chain grew and now starts at head */
+
+#endif
@@ -1,9 +1,11 @@
 /* $Id$ */
 
+#include <string.h> /*memcmp,memcpy*/
 #include "xmlc.h" /*xmlc_white_space*/
 #include "m.h"
 #include "s.h" /*s_tokcmpn*/
 #include "ht.h"
+#include "th.h"
 #include "rn.h"
 #include "xsd.h"
 #include "ll.h"
@@ -21,24 +23,128 @@ struct dtl {
 #define LEN_M DRV_LEN_M
 #define PRIME_M DRV_PRIME_M
 #define LIM_M DRV_LIM_M
+#define LEN_PM DRV_LEN_PM
+#define LEN_TR DRV_LEN_TR
+#define LIM_TR DRV_LIM_TR
+#define LEN_NM DRV_LEN_NM
+#define LEN_V DRV_LEN_V
+#define LIM_V DRV_LIM_V
+#define LEN_VS DRV_LEN_VS
+#define LEN_CX DRV_LEN_CX
+#define LIM_CX DRV_LIM_CX
+#define LEN_AL DRV_LEN_AL
+#define LEN_AS DRV_LEN_AS
+#define LIM_AS DRV_LIM_AS
+#define LEN_XS DRV_LEN_XS
+#define LIM_XS DRV_LIM_XS
 
 #define M_SIZE 5
 
 #define M_STO 0
-#define M_STC 1
-#define M_ATT 2
-#define M_TXT 3
-#define M_END 4
+#define M_ATT 1
+#define M_STO_R 2 /* recovery, kept apart from the transitions of valid documents */
+#define M_STC_R 3
+#define M_END_R 4
 #define M_SET(p) memo[i_m][M_SIZE-1]=p
 #define M_RET(m) memo[m][M_SIZE-1]
 
+/* derivatives that depend on the pattern only are kept in pm, indexed by pattern; 0 is unknown.
+ start tag transitions: pm[p][PM_STO] heads a list of {uri,name,ret,next} in tr, 0 terminates the list */
+#define PM_SIZE 6
+#define PM_STO 0
+#define PM_STC 1
+#define PM_TXT 2
+#define PM_END 3
+#define PM_CX 4
+#define PM_AL 5
+
+#define TR_SIZE 4
+#define TR_NEXT(t) tr[t][TR_SIZE-1]
+
+/* name classes that are choices or exceptions are compiled into flags of {nc,uri,name} in nm,
+ name is -1 for a whole namespace; ncm[nc] tells how nc is compiled */
+#define NM_SIZE 4
+#define NM_ANY -1
+#define NM_FLG(i) nm[i][NM_SIZE-1]
+
+#define NCM_NONE 1 /* names and namespaces */
+#define NCM_ANY 2 /* any name, with exceptions */
+#define NCM_FAIL 3 /* matched with ncof */
+
+#define NM_QIN 0x1 /* the name is in a choice */
+#define NM_QNX 0x2 /* the name is excluded from its namespace */
+#define NM_QAX 0x4 /* the name is excluded from any name */
+#define NM_QAI 0x8 /* the name is an exception in an excluded namespace */
+#define NM_NIN 0x10 /* the namespace is in a choice */
+#define NM_NAX 0x20 /* the namespace is excluded from any name */
+
+/* choices of at least LIM_CX alternatives are indexed by element name: pm[p][PM_CX] is the root
+ of the tree of p in cx, or -1 if p is not indexed. A node is {p,hi,left,right}, left is 0 for an alternative;
+ alternatives are numbered from left to right, hi is past the last alternative under the node.
+ {root,uri,name,head,tail} in cn lists in cl, as {alt,next}, the alternatives whose name classes contain the name;
+ the list for name -1 holds the alternatives that may accept other names too */
+#define CX_SIZE 4
+#define CN_SIZE 5
+#define CL_SIZE 2
+
+/* plain attribute lists: pm[p][PM_AL] is 1 if p is After(c,k) where c groups or interleaves attributes
+ with distinct names, optional attributes, and patterns without attributes, -1 otherwise;
+ {p,uri,name,v} in al are the attributes of c. {p,n,i,ret} in as is the start tag close derivative
+ after the attributes listed in sq[i..i+n), as indices in al; the list being matched is at i_sq */
+#define AL_SIZE 4
+#define AS_SIZE 4
+
+/* ahead of time, states reachable from the start by start tags without attributes, mixed text and
+ end tags, with continuations kept by the caller, are listed in xs, and their start tag transitions
+ are put into tr; the states and the derivatives in xr are kept when patterns are collected */
+
+/* text derivatives for values up to LEN_VS bytes long: {p,n,ret} in vm, the value in vs */
+#define V_SIZE 3
+
 int drv_compact=0;
+int drv_lim_m=LIM_M;
 
-static struct dtl *dtl;
-static int len_dtl,n_dtl;
-static int (*memo)[M_SIZE];
-static int i_m,len_m;
-static struct hashtable ht_m;
+static TH_LOCAL struct dtl *dtl;
+static TH_LOCAL int len_dtl,n_dtl;
+static TH_LOCAL int (*memo)[M_SIZE];
+static TH_LOCAL int i_m,len_m,n_m,hand_m;
+static TH_LOCAL char *ref_m; /* reference bits for eviction in compact mode */
+static TH_LOCAL struct hashtable ht_m;
+static TH_LOCAL int (*pm)[PM_SIZE];
+static TH_LOCAL int len_pm;
+static TH_LOCAL int (*tr)[TR_SIZE];
+static TH_LOCAL int i_tr,len_tr;
+
+static TH_LOCAL int (*nm)[NM_SIZE];
+static TH_LOCAL int i_nm,len_nm;
+static TH_LOCAL struct hashtable ht_nm;
+static TH_LOCAL int *ncm,len_ncm;
+static TH_LOCAL int (*cx)[CX_SIZE];
+static TH_LOCAL int i_cx,len_cx,n_alt;
+static TH_LOCAL int (*cn)[CN_SIZE];
+static TH_LOCAL int i_cn,len_cn;
+static TH_LOCAL struct hashtable ht_cn;
+static TH_LOCAL int (*cl)[CL_SIZE];
+static TH_LOCAL int i_cl,len_cl;
+static TH_LOCAL int (*al)[AL_SIZE];
+static TH_LOCAL int i_al,len_al;
+static TH_LOCAL struct hashtable ht_al;
+static TH_LOCAL int (*as)[AS_SIZE];
+static TH_LOCAL int i_as,len_as;
+static TH_LOCAL struct hashtable ht_as;
+static TH_LOCAL int *sq;
+static TH_LOCAL int i_sq,len_sq,n_sq,p_sq;
+static TH_LOCAL int *xs,*xr;
+static TH_LOCAL int n_xs,len_xs,n_xr,len_xr;
+static TH_LOCAL struct hashtable ht_xs;
+static TH_LOCAL int (*vm)[V_SIZE];
+static TH_LOCAL char (*vs)[LEN_VS];
+static TH_LOCAL int i_v,len_v,n_v,hand_v;
+static TH_LOCAL char *ref_v;
+static TH_LOCAL struct hashtable ht_v;
+static TH_LOCAL int n_err;
+
+TH_LOCAL int drv_n_sto,drv_n_sto_hit,drv_n_txt,drv_n_txt_hit;
 
 #define err(msg) (*er_vprintf)(msg"\n",ap);
 void drv_default_verror_handler(int erno,va_list ap) {
@@ -52,70 +158,189 @@ void drv_default_verror_handler(int erno,va_list ap) {
   }
 }
 
-void (*drv_verror_handler)(int erno,va_list ap)=&drv_default_verror_handler;
+TH_LOCAL void (*drv_verror_handler)(int erno,va_list ap)=&drv_default_verror_handler;
 
 static void error_handler(int erno,...) {
-  va_list ap; va_start(ap,erno); (*drv_verror_handler)(erno,ap); va_end(ap);
+  va_list ap; va_start(ap,erno); ++n_err; (*drv_verror_handler)(erno,ap); va_end(ap);
 }
 
-static void verror_handler_xsd(int erno,va_list ap) {(*drv_verror_handler)(erno|ERBIT_XSD,ap);}
+static void verror_handler_xsd(int erno,va_list ap) {++n_err; (*drv_verror_handler)(erno|ERBIT_XSD,ap);}
 
 static void new_memo(int typ) {
-  if(drv_compact) ht_deli(&ht_m,i_m);
   memo[i_m][0]=typ;
 }
 
+static int get_m(void) {
+  int m=ht_get(&ht_m,i_m);
+  if(m!=-1) ref_m[m]=1;
+  return m;
+}
+
 static int equal_m(int m1,int m2) {
   int *me1=memo[m1],*me2=memo[m2];
   return (me1[0]==me2[0])&&(me1[1]==me2[1])&&(me1[2]==me2[2])&&(me1[3]==me2[3]);
 }
 static int hash_m(int m) {
   int *me=memo[m];
-  return ((me[0]&0x7)|((me[1]^me[2]^me[3])<<3))*PRIME_M;
+  return (int)(((me[0]&0x7)|((unsigned)(me[1]^me[2]^me[3])<<3))*PRIME_M);
 }
 
 static int newStartTagOpen(int p,int uri,int name) {
   int *me=memo[i_m];
   new_memo(M_STO);
   me[1]=p; me[2]=uri; me[3]=name;
-  return ht_get(&ht_m,i_m);
+  return get_m();
 }
 
 static int newAttributeOpen(int p,int uri,int name) {
   int *me=memo[i_m];
   new_memo(M_ATT);
   me[1]=p; me[2]=uri; me[3]=name;
-  return ht_get(&ht_m,i_m);
+  return get_m();
 }
 
-static int newStartTagClose(int p) {
+static int newRecover(int typ,int p,int uri,int name) {
   int *me=memo[i_m];
-  new_memo(M_STC);
-  me[1]=p; me[2]=me[3]=0;
-  return ht_get(&ht_m,i_m);
+  new_memo(typ);
+  me[1]=p; me[2]=uri; me[3]=name;
+  return get_m();
 }
 
-static int newMixedText(int p) {
-  int *me=memo[i_m];
-  new_memo(M_TXT);
-  me[1]=p; me[2]=me[3]=0;
-  return ht_get(&ht_m,i_m);
+/* i_m is a free record; once drv_lim_m records are used in compact mode,
+ the free record is taken from the table with the clock algorithm: records
+ looked up since the hand last passed them get a second chance */
+static void accept_m(void) {
+  if(ht_get(&ht_m,i_m)!=-1) return;
+  ht_put(&ht_m,i_m); ref_m[i_m]=0;
+  if(drv_compact&&n_m>=drv_lim_m) {
+    for(;;) {
+      if(hand_m>=n_m) hand_m=0;
+      if(!ref_m[hand_m]) break;
+      ref_m[hand_m++]=0;
+    }
+    i_m=hand_m++;
+    ht_deli(&ht_m,i_m);
+  } else {
+    i_m=n_m++;
+    if(i_m==len_m) {
+      memo=(int(*)[M_SIZE])m_stretch(memo,len_m=2*i_m,i_m,sizeof(int[M_SIZE]));
+      ref_m=(char*)m_stretch(ref_m,len_m,i_m,sizeof(char));
+    }
+  }
 }
 
-static int newEndTag(int p) {
-  int *me=memo[i_m];
-  new_memo(M_END);
-  me[1]=p; me[2]=me[3]=0;
-  return ht_get(&ht_m,i_m);
+static int equal_nm(int i1,int i2) {
+  int *me1=nm[i1],*me2=nm[i2];
+  return (me1[0]==me2[0])&&(me1[1]==me2[1])&&(me1[2]==me2[2]);
+}
+static int hash_nm(int i) {
+  int *me=nm[i];
+  return (me[0]*31+me[1])*31+me[2];
 }
 
-static void accept_m(void) {
-  if(ht_get(&ht_m,i_m)!=-1) {
-    if(drv_compact) ht_del(&ht_m,i_m); else return;
+static int equal_al(int i1,int i2) {
+  int *me1=al[i1],*me2=al[i2];
+  return (me1[0]==me2[0])&&(me1[1]==me2[1])&&(me1[2]==me2[2]);
+}
+static int hash_al(int i) {
+  int *me=al[i];
+  return (me[0]*31+me[1])*31+me[2];
+}
+
+static int equal_as(int i1,int i2) {
+  int *me1=as[i1],*me2=as[i2];
+  return (me1[0]==me2[0])&&(me1[1]==me2[1])&&memcmp(sq+me1[2],sq+me2[2],me1[1]*sizeof(int))==0;
+}
+static int hash_as(int i) {
+  int *me=as[i],*q=sq+me[2],*end=q+me[1]; unsigned h=(unsigned)me[0];
+  while(q!=end) h=h*31+*(q++);
+  return (int)h;
+}
+
+static int equal_xs(int i1,int i2) {return xs[i1]==xs[i2];}
+static int hash_xs(int i) {return xs[i]*PRIME_M;}
+
+static int equal_cn(int i1,int i2) {
+  int *me1=cn[i1],*me2=cn[i2];
+  return (me1[0]==me2[0])&&(me1[1]==me2[1])&&(me1[2]==me2[2]);
+}
+static int hash_cn(int i) {
+  int *me=cn[i];
+  return (me[0]*31+me[1])*31+me[2];
+}
+
+static int equal_v(int v1,int v2) {
+  int *me1=vm[v1],*me2=vm[v2];
+  return (me1[0]==me2[0])&&(me1[1]==me2[1])&&memcmp(vs[v1],vs[v2],me1[1])==0;
+}
+static int hash_v(int v) {
+  int *me=vm[v],i; unsigned h=(unsigned)me[0];
+  for(i=0;i!=me[1];++i) h=h*31+vs[v][i];
+  return (int)h;
+}
+
+static int newText(int p,char *s,int n) {
+  int v;
+  vm[i_v][0]=p; vm[i_v][1]=n; memcpy(vs[i_v],s,n);
+  if((v=ht_get(&ht_v,i_v))!=-1) ref_v[v]=1;
+  return v;
+}
+
+/* same as accept_m, but always bounded */
+static void accept_v(void) {
+  if(ht_get(&ht_v,i_v)!=-1) return;
+  ht_put(&ht_v,i_v); ref_v[i_v]=0;
+  if(n_v>=LIM_V) {
+    for(;;) {
+      if(hand_v>=n_v) hand_v=0;
+      if(!ref_v[hand_v]) break;
+      ref_v[hand_v++]=0;
+    }
+    i_v=hand_v++;
+    ht_deli(&ht_v,i_v);
+  } else {
+    i_v=n_v++;
+    if(i_v==len_v) {
+      vm=(int(*)[V_SIZE])m_stretch(vm,len_v=2*i_v,i_v,sizeof(int[V_SIZE]));
+      vs=(char(*)[LEN_VS])m_stretch(vs,len_v,i_v,sizeof(char[LEN_VS]));
+      ref_v=(char*)m_stretch(ref_v,len_v,i_v,sizeof(char));
+    }
+  }
+}
+
+static int getPm(int p,int i) {return p<len_pm?pm[p][i]:0;}
+
+static void setPm(int p,int i,int ret) {
+  if(p>=len_pm) {
+    int p0=len_pm,j;
+    pm=(int(*)[PM_SIZE])m_stretch(pm,len_pm=2*(p+1),p0,sizeof(int[PM_SIZE]));
+    for(;p0!=len_pm;++p0) for(j=0;j!=PM_SIZE;++j) pm[p0][j]=0;
   }
-  ht_put(&ht_m,i_m++);
-  if(drv_compact&&i_m==LIM_M) i_m=0;
-  if(i_m==len_m) memo=(int(*)[M_SIZE])m_stretch(memo,len_m=2*i_m,i_m,sizeof(int[M_SIZE]));
+  pm[p][i]=ret;
+}
+
+static void clear_tr(void) {
+  int p;
+  for(p=0;p!=len_pm;++p) pm[p][PM_STO]=0;
+  i_tr=1;
+}
+
+static int getTr(int p,int uri,int name) {
+  int t,t0=0;
+  for(t=getPm(p,PM_STO);t;t=TR_NEXT(t0=t)) {
+    if(tr[t][0]==uri&&tr[t][1]==name) {
+      if(t0) {TR_NEXT(t0)=TR_NEXT(t); TR_NEXT(t)=pm[p][PM_STO]; pm[p][PM_STO]=t;} /* move to front */
+      return t;
+    }
+  }
+  return 0;
+}
+
+static void putTr(int p,int uri,int name,int ret) {
+  if(drv_compact&&i_tr==LIM_TR) clear_tr();
+  if(i_tr==len_tr) tr=(int(*)[TR_SIZE])m_stretch(tr,len_tr=2*i_tr,i_tr,sizeof(int[TR_SIZE]));
+  tr[i_tr][0]=uri; tr[i_tr][1]=name; tr[i_tr][2]=ret;
+  TR_NEXT(i_tr)=getPm(p,PM_STO); setPm(p,PM_STO,i_tr++);
 }
 
 static int fallback_equal(char *typ,char *val,char *s,int n) {return 1;}
@@ -133,20 +358,65 @@ static int builtin_allows(char *typ,char *ps,char *s,int n) {return 1;}
 
 static void windup(void);
 
-static int initialized=0;
+static TH_LOCAL int initialized=0;
 void drv_init(void) {
   if(!initialized) { initialized=1;
     rn_init();
     xsd_init(); xsd_verror_handler=&verror_handler_xsd;
     memo=(int (*)[M_SIZE])m_alloc(len_m=LEN_M,sizeof(int[M_SIZE]));
+    ref_m=(char*)m_alloc(len_m,sizeof(char));
     dtl=(struct dtl*)m_alloc(len_dtl=LEN_DTL,sizeof(struct dtl));
     ht_init(&ht_m,LEN_M,&hash_m,&equal_m);
+    pm=(int(*)[PM_SIZE])m_alloc(len_pm=LEN_PM,sizeof(int[PM_SIZE]));
+    tr=(int(*)[TR_SIZE])m_alloc(len_tr=LEN_TR,sizeof(int[TR_SIZE]));
+    nm=(int(*)[NM_SIZE])m_alloc(len_nm=LEN_NM,sizeof(int[NM_SIZE]));
+    ht_init(&ht_nm,LEN_NM,&hash_nm,&equal_nm);
+    ncm=(int*)m_alloc(len_ncm=LEN_NM,sizeof(int));
+    cx=(int(*)[CX_SIZE])m_alloc(len_cx=LEN_CX,sizeof(int[CX_SIZE]));
+    cn=(int(*)[CN_SIZE])m_alloc(len_cn=LEN_CX,sizeof(int[CN_SIZE]));
+    ht_init(&ht_cn,LEN_CX,&hash_cn,&equal_cn);
+    cl=(int(*)[CL_SIZE])m_alloc(len_cl=LEN_CX,sizeof(int[CL_SIZE]));
+    al=(int(*)[AL_SIZE])m_alloc(len_al=LEN_AL,sizeof(int[AL_SIZE]));
+    ht_init(&ht_al,LEN_AL,&hash_al,&equal_al);
+    as=(int(*)[AS_SIZE])m_alloc(len_as=LEN_AS,sizeof(int[AS_SIZE]));
+    ht_init(&ht_as,LEN_AS,&hash_as,&equal_as);
+    sq=(int*)m_alloc(len_sq=LEN_AS,sizeof(int));
+    xs=(int*)m_alloc(len_xs=LEN_XS,sizeof(int));
+    xr=(int*)m_alloc(len_xr=LEN_XS,sizeof(int));
+    ht_init(&ht_xs,LEN_XS,&hash_xs,&equal_xs);
+    vm=(int(*)[V_SIZE])m_alloc(len_v=LEN_V,sizeof(int[V_SIZE]));
+    vs=(char(*)[LEN_VS])m_alloc(len_v,sizeof(char[LEN_VS]));
+    ref_v=(char*)m_alloc(len_v,sizeof(char));
+    ht_init(&ht_v,LEN_V,&hash_v,&equal_v);
     windup();
   }
 }
 
+static void clear_as(void) {
+  ht_clear(&ht_as);
+  i_as=i_sq=0; n_sq=-1;
+}
+
+static void forget(void) {
+  int p,i;
+  ht_clear(&ht_m); ht_clear(&ht_v);
+  i_m=0; n_m=1; hand_m=0;
+  i_v=0; n_v=1; hand_v=0;
+  for(p=0;p!=len_pm;++p) for(i=0;i!=PM_SIZE;++i) pm[p][i]=0;
+  i_tr=1;
+  i_cx=1; ht_clear(&ht_cn); i_cn=0; i_cl=1;
+  ht_clear(&ht_al); i_al=0;
+  clear_as();
+}
+
 static void windup(void) {
-  i_m=0; n_dtl=0;
+  int nc;
+  forget();
+  ht_clear(&ht_xs); n_xs=n_xr=0;
+  ht_clear(&ht_nm); i_nm=0;
+  for(nc=0;nc!=len_ncm;++nc) ncm[nc]=0;
+  n_dtl=0; n_err=0;
+  drv_n_sto=drv_n_sto_hit=drv_n_txt=drv_n_txt_hit=0;
   drv_add_dtl(rn_string+0,&fallback_equal,&fallback_allows); /* guard at 0 */
   drv_add_dtl(rn_string+0,&builtin_equal,&builtin_allows);
   drv_add_dtl(rn_string+rn_xsd_uri,&xsd_equal,&xsd_allows);
@@ -157,6 +427,28 @@ void drv_clear(void) {
   windup();
 }
 
+static void explore(int i);
+
+int drv_collect(int *roots,int n_roots) {
+  int *all,n=n_roots+n_xs+n_xr;
+  all=(int*)m_alloc(n,sizeof(int));
+  memcpy(all,roots,n_roots*sizeof(int));
+  memcpy(all+n_roots,xs,n_xs*sizeof(int));
+  memcpy(all+n_roots+n_xs,xr,n_xr*sizeof(int));
+  if(!rn_collect(all,n)) {m_free(all); return 0;}
+  memcpy(roots,all,n_roots*sizeof(int));
+  memcpy(xs,all+n_roots,n_xs*sizeof(int));
+  m_free(all);
+  forget();
+  if(n_xs) { /* the transitions are found again among the kept patterns */
+    int i;
+    ht_clear(&ht_xs); n_xr=0;
+    for(i=0;i!=n_xs;++i) ht_put(&ht_xs,i);
+    explore(0);
+  }
+  return 1;
+}
+
 void drv_add_dtl(char *suri,int (*equal)(char *typ,char *val,char *s,int n),int (*allows)(char *typ,char *ps,char *s,int n)) {
   if(n_dtl==len_dtl) dtl=(struct dtl *)m_stretch(dtl,len_dtl=n_dtl*2,n_dtl,sizeof(struct dtl));
   dtl[n_dtl].uri=rn_newString(suri);
@@ -186,6 +478,88 @@ static int ncof(int nc,int uri,int name) {
   return 0;
 }
 
+static int getNm(int nc,int uri,int name) {
+  int i;
+  nm[i_nm][0]=nc; nm[i_nm][1]=uri; nm[i_nm][2]=name;
+  return (i=ht_get(&ht_nm,i_nm))==-1?0:NM_FLG(i);
+}
+
+/* returns 0 if nc cannot be compiled to flags */
+static int addNm(int nc,int uri,int name,int flg) {
+  int i;
+  nm[i_nm][0]=nc; nm[i_nm][1]=uri; nm[i_nm][2]=name;
+  if((i=ht_get(&ht_nm,i_nm))==-1) {
+    NM_FLG(i_nm)=0; ht_put(&ht_nm,i=i_nm++);
+    if(i_nm==len_nm) nm=(int(*)[NM_SIZE])m_stretch(nm,len_nm=2*i_nm,i_nm,sizeof(int[NM_SIZE]));
+  } else if(NM_FLG(i)&flg&(NM_NIN|NM_NAX)) return 0; /* the namespace is in two choices */
+  NM_FLG(i)|=flg;
+  return 1;
+}
+
+/* names excluded from namespace uri */
+static int compile_names(int top,int nc,int uri,int flg) {
+  int uri1,name,nc1,nc2;
+  switch(RN_NC_TYP(nc)) {
+  case RN_NC_QNAME: rn_QName(nc,uri1,name); return uri1!=uri||addNm(top,uri,name,flg);
+  case RN_NC_CHOICE: rn_NameClassChoice(nc,nc1,nc2); return compile_names(top,nc1,uri,flg)&&compile_names(top,nc2,uri,flg);
+  default: return 0;
+  }
+}
+
+/* names and namespaces excluded from any name */
+static int compile_except(int top,int nc) {
+  int uri,name,nc1,nc2;
+  switch(RN_NC_TYP(nc)) {
+  case RN_NC_QNAME: rn_QName(nc,uri,name); return addNm(top,uri,name,NM_QAX);
+  case RN_NC_NSNAME: rn_NsName(nc,uri); return addNm(top,uri,NM_ANY,NM_NAX);
+  case RN_NC_CHOICE: rn_NameClassChoice(nc,nc1,nc2); return compile_except(top,nc1)&&compile_except(top,nc2);
+  case RN_NC_EXCEPT: rn_NameClassExcept(nc,nc1,nc2);
+    if(!RN_NC_IS(nc1,RN_NC_NSNAME)) return 0;
+    rn_NsName(nc1,uri); return addNm(top,uri,NM_ANY,NM_NAX)&&compile_names(top,nc2,uri,NM_QAI);
+  default: return 0;
+  }
+}
+
+static int compile_nc(int top,int nc,int *any) {
+  int uri,name,nc1,nc2;
+  switch(RN_NC_TYP(nc)) {
+  case RN_NC_QNAME: rn_QName(nc,uri,name); return addNm(top,uri,name,NM_QIN);
+  case RN_NC_NSNAME: rn_NsName(nc,uri); return addNm(top,uri,NM_ANY,NM_NIN);
+  case RN_NC_ANY_NAME: if(*any) return 0; *any=1; return 1;
+  case RN_NC_CHOICE: rn_NameClassChoice(nc,nc1,nc2); return compile_nc(top,nc1,any)&&compile_nc(top,nc2,any);
+  case RN_NC_EXCEPT: rn_NameClassExcept(nc,nc1,nc2);
+    switch(RN_NC_TYP(nc1)) {
+    case RN_NC_NSNAME: rn_NsName(nc1,uri); return addNm(top,uri,NM_ANY,NM_NIN)&&compile_names(top,nc2,uri,NM_QNX);
+    case RN_NC_ANY_NAME: if(*any) return 0; *any=1; return compile_except(top,nc2);
+    default: return 0;
+    }
+  default: return 0;
+  }
+}
+
+static int nc_match(int nc,int uri,int name) {
+  int c,f,g;
+  switch(RN_NC_TYP(nc)) {
+  case RN_NC_CHOICE: case RN_NC_EXCEPT: break;
+  default: return ncof(nc,uri,name);
+  }
+  if(nc>=len_ncm) {
+    int nc0=len_ncm;
+    ncm=(int*)m_stretch(ncm,len_ncm=2*(nc+1),nc0,sizeof(int));
+    while(nc0!=len_ncm) ncm[nc0++]=0;
+  }
+  if(!(c=ncm[nc])) {
+    int any=0;
+    c=ncm[nc]=compile_nc(nc,nc,&any)?(any?NCM_ANY:NCM_NONE):NCM_FAIL;
+  }
+  if(c==NCM_FAIL) return ncof(nc,uri,name);
+  f=getNm(nc,uri,name); g=getNm(nc,uri,NM_ANY);
+  if(f&NM_QIN) return 1;
+  if((g&NM_NIN)&&!(f&NM_QNX)) return 1;
+  if(c==NCM_ANY) return !((f&NM_QAX)||((g&NM_NAX)&&!(f&NM_QAI)));
+  return 0;
+}
+
 static int apply_after(int (*f)(int q1,int q2),int p1,int p0) {
   int p11,p12;
   switch(RN_P_TYP(p1)) {
@@ -201,28 +575,127 @@ static int apply_after(int (*f)(int q1,int q2),int p1,int p0) {
   return 0;
 }
 
-static int start_tag_open(int p,int uri,int name,int recover) {
-  int nc,p1,p2,m,ret=0;
-  if(!recover) {
-    m=newStartTagOpen(p,uri,name);
-    if(m!=-1) return M_RET(m);
+/* a derivative in the right member of an interleave stays on the right,
+ so that the state of an interleave does not depend on the order in which the members were matched */
+static int evaeli_rn(int p2,int p1) {return rn_ileave(p1,p2);}
+
+static int newCx(int p) {
+  int t,l,r,p1,p2;
+  if(i_cx==len_cx) cx=(int(*)[CX_SIZE])m_stretch(cx,len_cx=2*i_cx,i_cx,sizeof(int[CX_SIZE]));
+  cx[t=i_cx++][0]=p;
+  if(RN_P_IS(p,RN_P_CHOICE)) {
+    rn_Choice(p,p1,p2);
+    l=newCx(p1); r=newCx(p2);
+  } else {l=r=0; ++n_alt;}
+  cx[t][1]=n_alt; cx[t][2]=l; cx[t][3]=r;
+  return t;
+}
+
+static int getCl(int root,int uri,int name) {
+  int i;
+  cn[i_cn][0]=root; cn[i_cn][1]=uri; cn[i_cn][2]=name;
+  return (i=ht_get(&ht_cn,i_cn))==-1?0:cn[i][3];
+}
+
+static void addCl(int root,int uri,int name,int alt) {
+  int i;
+  cn[i_cn][0]=root; cn[i_cn][1]=uri; cn[i_cn][2]=name;
+  if((i=ht_get(&ht_cn,i_cn))==-1) {
+    cn[i_cn][3]=cn[i_cn][4]=0; ht_put(&ht_cn,i=i_cn++);
+    if(i_cn==len_cn) cn=(int(*)[CN_SIZE])m_stretch(cn,len_cn=2*i_cn,i_cn,sizeof(int[CN_SIZE]));
+  } else if(cl[cn[i][4]][0]==alt) return; /* the name is twice in the name class */
+  if(i_cl==len_cl) cl=(int(*)[CL_SIZE])m_stretch(cl,len_cl=2*i_cl,i_cl,sizeof(int[CL_SIZE]));
+  cl[i_cl][0]=alt; cl[i_cl][1]=0;
+  if(cn[i][4]) cl[cn[i][4]][1]=i_cl; else cn[i][3]=i_cl;
+  cn[i][4]=i_cl++;
+}
+
+static int qnames(int nc) {
+  int nc1,nc2;
+  switch(RN_NC_TYP(nc)) {
+  case RN_NC_QNAME: return 1;
+  case RN_NC_CHOICE: rn_NameClassChoice(nc,nc1,nc2); return qnames(nc1)&&qnames(nc2);
+  default: return 0;
   }
+}
+
+static void index_names(int root,int nc,int alt) {
+  int uri,name,nc1,nc2;
+  switch(RN_NC_TYP(nc)) {
+  case RN_NC_QNAME: rn_QName(nc,uri,name); addCl(root,uri,name,alt); break;
+  case RN_NC_CHOICE: rn_NameClassChoice(nc,nc1,nc2); index_names(root,nc1,alt); index_names(root,nc2,alt); break;
+  default: assert(0);
+  }
+}
+
+/* returns the root of the index of choice p, or -1 if the choice is too narrow */
+static int getCx(int p) {
+  int root,t,p1,nc,alt;
+  if((root=getPm(p,PM_CX))) return root;
+  n_alt=0; root=newCx(p);
+  if(n_alt<LIM_CX) {i_cx=root; setPm(p,PM_CX,-1); return -1;}
+  for(t=root;t!=i_cx;++t) if(!cx[t][2]) {
+    alt=cx[t][1]-1;
+    switch(RN_P_TYP(p1=cx[t][0])) {
+    case RN_P_NOT_ALLOWED: case RN_P_EMPTY: case RN_P_TEXT:
+    case RN_P_LIST: case RN_P_DATA: case RN_P_DATA_EXCEPT: case RN_P_VALUE:
+    case RN_P_ATTRIBUTE:
+      break;
+    case RN_P_ELEMENT: nc=rn_pattern[p1+2];
+      if(qnames(nc)) {index_names(root,nc,alt); break;}
+      /* fall through */
+    default: addCl(root,-1,-1,alt);
+    }
+  }
+  setPm(p,PM_CX,root);
+  return root;
+}
+
+static int nextCl(int a,int r) {return a&&!(r&&cl[r][0]<cl[a][0])?cl[a][0]:r?cl[r][0]:-1;}
+
+static int start_tag_open(int p,int uri,int name,int recover);
+
+/* alternatives that are not on the lists a or r are notAllowed and skipped */
+static int start_tag_open_cx(int t,int *a,int *r,int uri,int name) {
+  int l,c,ret;
+  if(!(l=cx[t][2])) {
+    ret=start_tag_open(cx[t][0],uri,name,0);
+    c=cx[t][1]-1;
+    if(*a&&cl[*a][0]==c) *a=cl[*a][1]; else *r=cl[*r][1];
+    return ret;
+  }
+  ret=(c=nextCl(*a,*r))!=-1&&c<cx[l][1]?start_tag_open_cx(l,a,r,uri,name):rn_notAllowed;
+  l=cx[t][3];
+  return rn_choice(ret,(c=nextCl(*a,*r))!=-1&&c<cx[l][1]?start_tag_open_cx(l,a,r,uri,name):rn_notAllowed);
+}
+
+static int start_tag_open(int p,int uri,int name,int recover) {
+  int nc,p1,p2,m,t,ret=0;
+  if(!rn_elems(p)) return rn_notAllowed;
+  m=recover?newRecover(M_STO_R,p,uri,name):newStartTagOpen(p,uri,name);
+  if(m!=-1) return M_RET(m);
   switch(RN_P_TYP(p)) {
   case RN_P_NOT_ALLOWED: case RN_P_EMPTY: case RN_P_TEXT:
   case RN_P_LIST: case RN_P_DATA: case RN_P_DATA_EXCEPT: case RN_P_VALUE:
   case RN_P_ATTRIBUTE:
     ret=rn_notAllowed;
     break;
-  case RN_P_CHOICE: rn_Choice(p,p1,p2);
-    ret=rn_choice(start_tag_open(p1,uri,name,recover),start_tag_open(p2,uri,name,recover));
+  case RN_P_CHOICE:
+    if(!recover&&(t=getCx(p))!=-1) {
+      int a=getCl(t,uri,name),r=getCl(t,-1,-1);
+      ret=start_tag_open_cx(t,&a,&r,uri,name);
+    } else {
+      rn_Choice(p,p1,p2);
+      ret=rn_choice(start_tag_open(p1,uri,name,recover),start_tag_open(p2,uri,name,recover));
+    }
     break;
   case RN_P_ELEMENT: rn_Element(p,nc,p1);
-    ret=ncof(nc,uri,name)?rn_after(p1,rn_empty):rn_notAllowed;
+    ret=nc_match(nc,uri,name)?rn_after(p1,rn_empty):rn_notAllowed;
     break;
   case RN_P_INTERLEAVE: rn_Interleave(p,p1,p2);
     ret=rn_choice(
       apply_after(&rn_ileave,start_tag_open(p1,uri,name,recover),p2),
-      apply_after(&rn_ileave,start_tag_open(p2,uri,name,recover),p1));
+      apply_after(&evaeli_rn,start_tag_open(p2,uri,name,recover),p1));
     break;
   case RN_P_GROUP: rn_Group(p,p1,p2);
     { int p11=apply_after(&rn_group,start_tag_open(p1,uri,name,recover),p2);
@@ -236,20 +709,93 @@ static int start_tag_open(int p,int uri,int name,int recover) {
     break;
   default: assert(0);
   }
-  if(!recover) {
-    newStartTagOpen(p,uri,name); M_SET(ret);
-    accept_m();
-  }
+  if(recover) newRecover(M_STO_R,p,uri,name); else newStartTagOpen(p,uri,name);
+  M_SET(ret);
+  accept_m();
+  return ret;
+}
+
+int drv_start_tag_open(int p,char *suri,char *sname) {
+  int uri=rn_newString(suri),name=rn_newString(sname),t,ret;
+  ++drv_n_sto;
+  if((t=getTr(p,uri,name))) {++drv_n_sto_hit; return tr[t][2];}
+  ret=start_tag_open(p,uri,name,0);
+  putTr(p,uri,name,ret);
   return ret;
 }
+static void addXr(int p) {
+  xr[n_xr++]=p;
+  if(n_xr==len_xr) xr=(int*)m_stretch(xr,len_xr=2*n_xr,n_xr,sizeof(int));
+}
+
+static void addXs(int p) {
+  if(p==rn_notAllowed||n_xs==LIM_XS) return;
+  xs[n_xs]=p;
+  if(ht_get(&ht_xs,n_xs)!=-1) return;
+  ht_put(&ht_xs,n_xs++);
+  if(n_xs==len_xs) xs=(int*)m_stretch(xs,len_xs=2*n_xs,n_xs,sizeof(int));
+}
+
+static int start_tag_close(int p,int recover);
+static int mixed_text(int p);
+
+/* a state is split as by the caller when the start tag derivative is a single After;
+ choices of After patterns are left to the derivatives */
+static void explore_tr(int p,int uri,int name) {
+  int ret,p1,p2;
+  if(getTr(p,uri,name)) return;
+  ret=start_tag_open(p,uri,name,0);
+  putTr(p,uri,name,ret); addXr(ret);
+  if(RN_P_IS(ret,RN_P_AFTER)) {
+    ret=start_tag_close(ret,0); addXr(ret);
+    if(RN_P_IS(ret,RN_P_AFTER)) {rn_After(ret,p1,p2); addXs(p1); addXs(p2);}
+  }
+}
+
+static void explore_nc(int p,int nc) {
+  int uri,name,nc1,nc2;
+  switch(RN_NC_TYP(nc)) {
+  case RN_NC_QNAME: rn_QName(nc,uri,name); explore_tr(p,uri,name); break;
+  case RN_NC_CHOICE: rn_NameClassChoice(nc,nc1,nc2); explore_nc(p,nc1); explore_nc(p,nc2); break;
+  default: break; /* wildcards are matched when met */
+  }
+}
+
+/* tries the names of elements that may come first in p0 */
+static void explore_names(int p0,int p) {
+  int nc,p1,p2;
+  switch(RN_P_TYP(p)) {
+  case RN_P_ELEMENT: rn_Element(p,nc,p1); explore_nc(p0,nc); break;
+  case RN_P_CHOICE: rn_Choice(p,p1,p2); explore_names(p0,p1); explore_names(p0,p2); break;
+  case RN_P_INTERLEAVE: rn_Interleave(p,p1,p2); explore_names(p0,p1); explore_names(p0,p2); break;
+  case RN_P_GROUP: rn_Group(p,p1,p2); explore_names(p0,p1); if(rn_nullable(p1)) explore_names(p0,p2); break;
+  case RN_P_ONE_OR_MORE: rn_OneOrMore(p,p1); explore_names(p0,p1); break;
+  case RN_P_AFTER: rn_After(p,p1,p2); explore_names(p0,p1); break;
+  default: break;
+  }
+}
+
+static void explore(int i) {
+  int p;
+  for(;i!=n_xs;++i) {
+    p=xs[i]; explore_names(p,p);
+    addXs(mixed_text(p));
+  }
+}
+
+void drv_explore(int start) {
+  int i=n_xs;
+  addXs(start);
+  explore(i);
+}
 
-int drv_start_tag_open(int p,char *suri,char *sname) {return start_tag_open(p,rn_newString(suri),rn_newString(sname),0);}
 int drv_start_tag_open_recover(int p,char *suri,char *sname) {return start_tag_open(p,rn_newString(suri),rn_newString(sname),1);}
 
 static int puorg_rn(int p2,int p1) {return rn_group(p1,p2);}
 
 static int attribute_open(int p,int uri,int name) {
   int nc,p1,p2,m,ret=0;
+  if(!rn_attrs(p)) return rn_notAllowed;
   m=newAttributeOpen(p,uri,name);
   if(m!=-1) return M_RET(m);
   switch(RN_P_TYP(p)) {
@@ -262,12 +808,12 @@ static int attribute_open(int p,int uri,int name) {
     ret=rn_choice(attribute_open(p1,uri,name),attribute_open(p2,uri,name));
     break;
   case RN_P_ATTRIBUTE: rn_Attribute(p,nc,p1);
-    ret=ncof(nc,uri,name)?rn_after(p1,rn_empty):rn_notAllowed;
+    ret=nc_match(nc,uri,name)?rn_after(p1,rn_empty):rn_notAllowed;
     break;
   case RN_P_INTERLEAVE: rn_Interleave(p,p1,p2);
     ret=rn_choice(
       apply_after(&rn_ileave,attribute_open(p1,uri,name),p2),
-      apply_after(&rn_ileave,attribute_open(p2,uri,name),p1));
+      apply_after(&evaeli_rn,attribute_open(p2,uri,name),p1));
     break;
   case RN_P_GROUP: rn_Group(p,p1,p2);
     ret=rn_choice(
@@ -290,15 +836,100 @@ static int attribute_open(int p,int uri,int name) {
 int drv_attribute_open(int p,char *suri,char *sname) {return attribute_open(p,rn_newString(suri),rn_newString(sname));}
 int drv_attribute_open_recover(int p,char *suri,char *sname) {return p;}
 
+
+static int attributes(int p) {
+  int p1,p2;
+  switch(RN_P_TYP(p)) {
+  case RN_P_ATTRIBUTE: return 1;
+  case RN_P_CHOICE: rn_Choice(p,p1,p2); return attributes(p1)||attributes(p2);
+  case RN_P_INTERLEAVE: rn_Interleave(p,p1,p2); return attributes(p1)||attributes(p2);
+  case RN_P_GROUP: rn_Group(p,p1,p2); return attributes(p1)||attributes(p2);
+  case RN_P_ONE_OR_MORE: rn_OneOrMore(p,p1); return attributes(p1);
+  case RN_P_AFTER: rn_After(p,p1,p2); return attributes(p1)||attributes(p2);
+  default: return 0;
+  }
+}
+
+static int addAl(int p0,int p) {
+  int nc,v;
+  rn_Attribute(p,nc,v);
+  if(!RN_NC_IS(nc,RN_NC_QNAME)) return 0;
+  al[i_al][0]=p0; rn_QName(nc,al[i_al][1],al[i_al][2]); al[i_al][3]=v;
+  if(ht_get(&ht_al,i_al)!=-1) return 0;
+  ht_put(&ht_al,i_al++);
+  if(i_al==len_al) al=(int(*)[AL_SIZE])m_stretch(al,len_al=2*i_al,i_al,sizeof(int[AL_SIZE]));
+  return 1;
+}
+
+static int plain(int p0,int p) {
+  int p1,p2;
+  switch(RN_P_TYP(p)) {
+  case RN_P_ATTRIBUTE: return addAl(p0,p);
+  case RN_P_INTERLEAVE: rn_Interleave(p,p1,p2); return plain(p0,p1)&&plain(p0,p2);
+  case RN_P_GROUP: rn_Group(p,p1,p2); return plain(p0,p1)&&plain(p0,p2);
+  case RN_P_CHOICE: rn_Choice(p,p1,p2);
+    if(RN_P_IS(p1,RN_P_EMPTY)&&RN_P_IS(p2,RN_P_ATTRIBUTE)) return addAl(p0,p2);
+    if(RN_P_IS(p2,RN_P_EMPTY)&&RN_P_IS(p1,RN_P_ATTRIBUTE)) return addAl(p0,p1);
+    break;
+  }
+  return !attributes(p);
+}
+
+int drv_attribute_list_open(int p) {
+  int t;
+  if(!(t=getPm(p,PM_AL))) {
+    t=-1;
+    if(RN_P_IS(p,RN_P_AFTER)&&plain(p,rn_pattern[p+1])) t=1;
+    setPm(p,PM_AL,t);
+  }
+  p_sq=p; n_sq=t==1?0:-1;
+  return t==1;
+}
+
+int drv_attribute_list_name(char *suri,char *sname) {
+  int a;
+  if(n_sq==-1) return 0;
+  al[i_al][0]=p_sq; al[i_al][1]=rn_newString(suri); al[i_al][2]=rn_newString(sname);
+  if((a=ht_get(&ht_al,i_al))==-1) {n_sq=-1; return 0;}
+  if(i_sq+n_sq==len_sq) sq=(int*)m_stretch(sq,len_sq=2*(i_sq+n_sq),i_sq+n_sq,sizeof(int));
+  sq[i_sq+n_sq++]=a;
+  return 1;
+}
+
+int drv_attribute_list_close(void) {
+  int i;
+  if(n_sq==-1) return 0;
+  as[i_as][0]=p_sq; as[i_as][1]=n_sq; as[i_as][2]=i_sq;
+  return (i=ht_get(&ht_as,i_as))==-1?0:as[i][3];
+}
+
+/* the value is matched as text followed by attribute close; on error, returns a pattern
+ that expects the same as the derivative, for error reporting only: the state after the
+ list is the one drv_attribute_list_close returned */
+int drv_attribute_list_value(int i,char *s,int n) {
+  int v=al[sq[i_sq+i]][3],p=drv_text(v,s,n);
+  return rn_nullable(p)?0:rn_after(p==rn_notAllowed?v:p,rn_empty);
+}
+
+void drv_attribute_list_put(int p,int ret) {
+  if(n_sq==-1||p!=p_sq) return;
+  as[i_as][0]=p_sq; as[i_as][1]=n_sq; as[i_as][2]=i_sq; as[i_as][3]=ret;
+  if(ht_get(&ht_as,i_as)==-1) {
+    ht_put(&ht_as,i_as++); i_sq+=n_sq;
+    if(i_as==len_as) as=(int(*)[AS_SIZE])m_stretch(as,len_as=2*i_as,i_as,sizeof(int[AS_SIZE]));
+    if(drv_compact&&i_as==LIM_AS) clear_as();
+  }
+  n_sq=-1;
+}
+
 extern int drv_attribute_close(int p) {return drv_end_tag(p);}
 extern int drv_attribute_close_recover(int p) {return drv_end_tag_recover(p);}
 
 static int start_tag_close(int p,int recover) {
-  int p1,p2,ret=0,m;
-  if(!recover) {
-    m=newStartTagClose(p);
-    if(m!=-1) return M_RET(m);
-  }
+  int p1,p2,m,ret=0;
+  if(recover) {
+    if((m=newRecover(M_STC_R,p,0,0))!=-1) return M_RET(m);
+  } else if((ret=getPm(p,PM_STC))) return ret;
   switch(RN_P_TYP(p)) {
   case RN_P_NOT_ALLOWED: case RN_P_EMPTY: case RN_P_TEXT:
   case RN_P_LIST: case RN_P_DATA: case RN_P_DATA_EXCEPT: case RN_P_VALUE:
@@ -325,10 +956,10 @@ static int start_tag_close(int p,int recover) {
     break;
   default: assert(0);
   }
-  if(!recover) {
-    newStartTagClose(p); M_SET(ret);
+  if(recover) {
+    newRecover(M_STC_R,p,0,0); M_SET(ret);
     accept_m();
-  }
+  } else setPm(p,PM_STC,ret);
   return ret;
 }
 int drv_start_tag_close(int p) {return start_tag_close(p,0);}
@@ -397,13 +1028,22 @@ static int textws(int p,char *s,int n) {
   while(s!=end) {if(!xmlc_white_space(*s)) {ws=0; break;} ++s;}
   return ws?rn_choice(p,p1):p1;
 }
-int drv_text(int p,char *s,int n) {return textws(p,s,n);}
+/* short values are looked up in vm first; derivatives that reported errors are not kept,
+ so that the errors are reported every time */
+int drv_text(int p,char *s,int n) {
+  int v,ret,err;
+  if(n>LEN_VS) return textws(p,s,n);
+  ++drv_n_txt;
+  if((v=newText(p,s,n))!=-1) {++drv_n_txt_hit; return vm[v][2];}
+  err=n_err; ret=textws(p,s,n);
+  if(n_err==err) {newText(p,s,n); vm[i_v][2]=ret; accept_v();}
+  return ret;
+}
 int drv_text_recover(int p,char *s,int n) {return p;}
 
 static int mixed_text(int p) { /* matches text in mixed context */
-  int p1,p2,ret=0,m;
-  m=newMixedText(p);
-  if(m!=-1) return M_RET(m);
+  int p1,p2,ret=0;
+  if((ret=getPm(p,PM_TXT))) return ret;
   switch(RN_P_TYP(p)) {
   case RN_P_NOT_ALLOWED: case RN_P_EMPTY:
   case RN_P_ATTRIBUTE: case RN_P_ELEMENT:
@@ -431,19 +1071,17 @@ static int mixed_text(int p) { /* matches text in mixed context */
     break;
   default: assert(0);
   }
-  newMixedText(p); M_SET(ret);
-  accept_m();
+  setPm(p,PM_TXT,ret);
   return ret;
 }
 int drv_mixed_text(int p) {return mixed_text(p);}
 int drv_mixed_text_recover(int p) {return p;}
 
 static int end_tag(int p,int recover) {
-  int p1,p2,ret=0,m;
-  if(!recover) {
-    m=newEndTag(p);
-    if(m!=-1) return M_RET(m);
-  }
+  int p1,p2,m,ret=0;
+  if(recover) {
+    if((m=newRecover(M_END_R,p,0,0))!=-1) return M_RET(m);
+  } else if((ret=getPm(p,PM_END))) return ret;
   switch(RN_P_TYP(p)) {
   case RN_P_NOT_ALLOWED: case RN_P_EMPTY: case RN_P_TEXT:
   case RN_P_INTERLEAVE: case RN_P_GROUP: case RN_P_ONE_OR_MORE:
@@ -459,10 +1097,10 @@ static int end_tag(int p,int recover) {
     break;
   default: assert(0);
   }
-  if(!recover) {
-    newEndTag(p); M_SET(ret);
+  if(recover) {
+    newRecover(M_END_R,p,0,0); M_SET(ret);
     accept_m();
-  }
+  } else setPm(p,PM_END,ret);
   return ret;
 }
 int drv_end_tag(int p) {return end_tag(p,0);}
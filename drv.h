@@ -1,20 +1,32 @@
 /* $Id$ */
 
 #include <stdarg.h>
+#include "th.h"
 
 #ifndef DRV_H
 #define DRV_H 1
 
 #define DRV_ER_NODTL 0
 
-extern void (*drv_verror_handler)(int erno,va_list ap);
+extern TH_LOCAL void (*drv_verror_handler)(int erno,va_list ap);
 extern int drv_compact;
+extern int drv_lim_m; /* number of memoized derivatives in compact mode */
+
+/* number of start tags and of text values, and of those found in the caches */
+extern TH_LOCAL int drv_n_sto,drv_n_sto_hit,drv_n_txt,drv_n_txt_hit;
 
 extern void drv_default_verror_handler(int erno,va_list ap);
 
 extern void drv_init(void);
 extern void drv_clear(void);
 
+/* collects unused patterns, see rn_collect, and forgets memoized derivatives if it did */
+extern int drv_collect(int *roots,int n_roots);
+
+/* computes ahead of time the start tag transitions of the states reachable from start,
+ for a caller that keeps the continuations of open elements (rnv -k) */
+extern void drv_explore(int start);
+
 /* Expat passes character data unterminated.  Hence functions that can deal with cdata expect the length of the data */
 extern void drv_add_dtl(char *suri,int (*equal)(char *typ,char *val,char *s,int n),int (*allows)(char *typ,char *ps,char *s,int n));
 
@@ -24,6 +36,14 @@ extern int drv_attribute_open(int p,char *suri,char *s);
 extern int drv_attribute_open_recover(int p,char *suri,char *s);
 extern int drv_attribute_close(int p);
 extern int drv_attribute_close_recover(int p);
+/* plain attribute lists are matched by name, with start tag close derivatives known for lists seen before;
+ open tells if p is plain, close returns the derivative or 0 if the list is new, value returns 0 if
+ the value of the i-th attribute is valid; put records the derivative computed for a new list */
+extern int drv_attribute_list_open(int p);
+extern int drv_attribute_list_name(char *suri,char *sname);
+extern int drv_attribute_list_close(void);
+extern int drv_attribute_list_value(int i,char *s,int n);
+extern void drv_attribute_list_put(int p,int ret);
 extern int drv_start_tag_close(int p);
 extern int drv_start_tag_close_recover(int p);
 extern int drv_text(int p,char *s,int n);
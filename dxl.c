@@ -45,7 +45,7 @@ int dxl_allows(char *typ,char *ps,char *s,int n) {
     execv(dxl_cmd,argv);
     (*er_printf)("dxl: cannot execute %s: %s\n",dxl_cmd,strerror(errno));
  } else if(pid>0) {
-    wait(&status);
+    waitpid(pid,&status,0); /* other threads may have children too */
     return !WEXITSTATUS(status);
   }
   (*er_printf)("dxl: %s\n",strerror(errno));
@@ -64,7 +64,7 @@ int dxl_equal(char *typ,char *val,char *s,int n) {
      execvp(dxl_cmd,argv);
     (*er_printf)("dxl: cannot execute %s\n",dxl_cmd,strerror(errno));
   } else if(pid>0) {
-    wait(&status);
+    waitpid(pid,&status,0);
     return !WEXITSTATUS(status);
   }
   (*er_printf)("dxl: %s\n",strerror(errno));
@@ -2,89 +2,209 @@
 
 #include <stdlib.h> /*NULL*/
 #include <assert.h> /*assert*/
+#include <string.h> /*memset*/
+#if __SSE2__
+#include <emmintrin.h>
+#endif
 #include "m.h"
 #include "ht.h"
 
+/* open addressing with a control byte per slot: 7 bits of the hash value for a full slot,
+ EMPTY or DELETED otherwise; slots are probed in groups of GROUP, and ids are compared only
+ in the slots whose control bytes match. The first GROUP control bytes are repeated after
+ the last so that a group can start at any slot. */
+
+#define GROUP 16
+#define EMPTY 0x80
+#define DELETED 0xFE
 #define LOAD_FACTOR 2
+#define LIMIT(n) ((n)-(n)/8)
+
+#define h2(hv) ((unsigned)(hv)*0x9E3779B1u>>25)
+
+#if __SSE2__
+#define match(g,b) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8((char)(b)),g))
+#define load(ctrl,j) _mm_loadu_si128((__m128i*)((ctrl)+(j)))
+#define free_slots(g) _mm_movemask_epi8(g) /* EMPTY and DELETED have the high bit set */
+typedef __m128i group;
+#else
+typedef unsigned char *group;
+#define load(ctrl,j) ((ctrl)+(j))
+static int match(group g,int b) {
+  int i,m=0;
+  for(i=0;i!=GROUP;++i) if(g[i]==b) m|=1<<i;
+  return m;
+}
+static int free_slots(group g) {
+  int i,m=0;
+  for(i=0;i!=GROUP;++i) if(g[i]&0x80) m|=1<<i;
+  return m;
+}
+#endif
+
+#if __GNUC__
+#define lowbit(m) __builtin_ctz(m)
+#else
+static int lowbit(unsigned m) {int k=0; while(!(m&1)) {m>>=1; ++k;} return k;}
+#endif
+
+static void alloc(struct hashtable *ht,int tablen) {
+  ht->tablen=tablen; ht->limit=LIMIT(tablen);
+  ht->table=(int*)m_alloc(tablen<<1,sizeof(int)); /* the second half is hash values */
+  ht->ctrl=(unsigned char*)m_alloc(tablen+GROUP,sizeof(unsigned char));
+}
+
+/* ids are read only in full slots and are left uninitialized */
+static void empty(struct hashtable *ht) {
+  ht->deleted=0;
+  memset(ht->ctrl,EMPTY,ht->tablen+GROUP);
+}
+
+static void drop_old(struct hashtable *ht) {
+  if(ht->oldtable) {
+    m_free(ht->oldtable); ht->oldtable=NULL;
+    m_free(ht->oldctrl); ht->oldctrl=NULL;
+  }
+  ht->oldused=0;
+}
 
 void ht_init(struct hashtable *ht,int len,int (*hash)(int),int (*equal)(int,int)) {
+  int tablen=GROUP;
   assert(len>0);
-  ht->tablen=1; len*=LOAD_FACTOR;
-  while(ht->tablen<len) ht->tablen<<=1;
-  ht->limit=ht->tablen/LOAD_FACTOR;
-  ht->table=(int*)m_alloc(ht->tablen<<1,sizeof(int)); /* the second half is hash values */
+  len*=LOAD_FACTOR;
+  while(tablen<len) tablen<<=1;
+  alloc(ht,tablen);
+  ht->oldtable=NULL; ht->oldctrl=NULL;
   ht->hash=hash; ht->equal=equal;
   ht_clear(ht);
 }
 
 void ht_clear(struct hashtable *ht) {
-  int i;
-  ht->used=0; for(i=0;i!=ht->tablen;++i) ht->table[i]=-1;
+  drop_old(ht);
+  ht->used=0; empty(ht);
 }
 
 void ht_dispose(struct hashtable *ht) {
+  drop_old(ht);
   m_free(ht->table); ht->table=NULL;
+  m_free(ht->ctrl); ht->ctrl=NULL;
 }
 
-#define first(ht,hv) (hv&(ht->tablen-1))
-#define next(ht,i) (i==0?ht->tablen-1:i-1)
+static void set_ctrl(unsigned char *ctrl,int tablen,int j,int c) {
+  ctrl[j]=c;
+  if(j<GROUP) ctrl[tablen+j]=c;
+}
 
-int ht_get(struct hashtable *ht,int i) {
-  int hv=ht->hash(i),j;
-  for(j=first(ht,hv);;j=next(ht,j)) {
-    int tj=ht->table[j];
-    if(tj==-1) break;
-    if(ht->equal(i,tj)) return tj;
+/* groups are probed at triangular offsets, which visits every group of a table of 2^n slots */
+#define first(tablen,hv) (hv&(tablen-1))
+#define next(tablen,j,stride) ((j+(stride+=GROUP))&(tablen-1))
+
+/* the slot of i in one of the arrays, or -1 */
+static int find(struct hashtable *ht,int *table,unsigned char *ctrl,int tablen,int i,int hv,int eq) {
+  int c=h2(hv),j,stride=0,m;
+  for(j=first(tablen,hv);;j=next(tablen,j,stride)) {
+    group g=load(ctrl,j);
+    for(m=match(g,c);m;m&=m-1) {
+      int k=(j+lowbit(m))&(tablen-1),tk=table[k];
+      if(eq?i==tk:ht->equal(i,tk)) return k;
+    }
+    if(match(g,EMPTY)) return -1;
   }
-  return -1;
 }
 
-void ht_put(struct hashtable *ht,int i) {
-  int hv=ht->hash(i),j;
-  if(ht->used==ht->limit) {
-    int tablen=ht->tablen; int *table=ht->table;
-    ht->tablen<<=1; ht->limit<<=1;
-    ht->table=(int*)m_alloc(ht->tablen<<1,sizeof(int));
-    for(j=0;j!=ht->tablen;++j) ht->table[j]=-1;
-    for(j=0;j!=tablen;++j) {
-      if(table[j]!=-1) {
-	int hvj=table[j|tablen]; int k;
-	for(k=first(ht,hvj);ht->table[k]!=-1;k=next(ht,k));
-	ht->table[k]=table[j]; ht->table[k|ht->tablen]=hvj;
-      }
-    }
-    m_free(table);
+/* the first free slot on the probe sequence of hv */
+static int slot(struct hashtable *ht,int hv) {
+  int j,stride=0,m;
+  for(j=first(ht->tablen,hv);;j=next(ht->tablen,j,stride)) {
+    if((m=free_slots(load(ht->ctrl,j)))) return (j+lowbit(m))&(ht->tablen-1);
   }
-  for(j=first(ht,hv);ht->table[j]!=-1;j=next(ht,j)) assert(!ht->equal(i,ht->table[j]));
+}
+
+static void insert(struct hashtable *ht,int i,int hv) {
+  int j=slot(ht,hv);
+  if(ht->ctrl[j]==DELETED) --ht->deleted;
   ht->table[j]=i;
   ht->table[ht->tablen|j]=hv;
-  ++ht->used;
+  set_ctrl(ht->ctrl,ht->tablen,j,h2(hv));
 }
 
-static int del(struct hashtable *ht,int i,int eq) {
-  if(ht->used!=0) {
-    int hv=ht->hash(i),j;
-    for(j=first(ht,hv);;j=next(ht,j)) {
-      int tj=ht->table[j];
-      if(tj==-1) break;
-      if(eq?i==tj:ht->equal(i,tj)) {
-	do {
-	  int k=j,j0;
-	  ht->table[j]=-1;
-	  for(;;) {
-	    j=next(ht,j);
-	    if(ht->table[j]==-1) break;
-	    j0=first(ht,ht->table[j|ht->tablen]);
-	    if((k<=j0||j0<j)&&(j0<j||j<=k)&&(j<=k||k<=j0)) break;
-	  }
-	  ht->table[k]=ht->table[j]; ht->table[k|ht->tablen]=ht->table[j|ht->tablen];
-	} while(ht->table[j]!=-1);
-	--ht->used;
-	return tj;
-      }
+/* a full table is not rehashed at once: a new array is allocated, and every operation moves
+ STEP slots of the old array to it; until all are moved, lookups search both arrays.
+ The new array is twice as large, or as large if the old one is full of deleted slots.
+ STEP is large enough for the moving to finish before the new array fills up. */
+#define STEP (2*GROUP)
+
+static void move(struct hashtable *ht,int n) {
+  int j;
+  for(;n!=0&&ht->moved!=ht->oldlen;--n) {
+    j=ht->moved++;
+    if(!(ht->oldctrl[j]&0x80)) {
+      insert(ht,ht->oldtable[j],ht->oldtable[j|ht->oldlen]);
+      set_ctrl(ht->oldctrl,ht->oldlen,j,DELETED); --ht->oldused;
     }
   }
+  if(ht->moved==ht->oldlen) drop_old(ht);
+}
+#define step(ht) do {if(ht->oldtable) move(ht,STEP);} while(0)
+
+static void grow(struct hashtable *ht) {
+  int tablen=ht->tablen;
+  if(ht->oldtable) move(ht,ht->oldlen); /* not reached with STEP as above */
+  ht->oldtable=ht->table; ht->oldctrl=ht->ctrl; ht->oldlen=tablen;
+  ht->oldused=ht->used; ht->moved=0;
+  alloc(ht,2*ht->used>=ht->limit?tablen<<1:tablen);
+  empty(ht);
+}
+
+/* searches both arrays without moving slots, so that assertions do not change what is moved */
+static int get(struct hashtable *ht,int i,int hv) {
+  int j;
+  if((j=find(ht,ht->table,ht->ctrl,ht->tablen,i,hv,0))!=-1) return ht->table[j];
+  if(ht->oldtable&&(j=find(ht,ht->oldtable,ht->oldctrl,ht->oldlen,i,hv,0))!=-1) return ht->oldtable[j];
   return -1;
 }
+
+int ht_get(struct hashtable *ht,int i) {
+  int hv=ht->hash(i);
+  step(ht);
+  return get(ht,i,hv);
+}
+
+/* a step can move up to STEP slots into the new array, so the count is compared with >= */
+void ht_put(struct hashtable *ht,int i) {
+  assert(get(ht,i,ht->hash(i))==-1);
+  step(ht);
+  if(ht->used-ht->oldused+ht->deleted>=ht->limit) grow(ht);
+  insert(ht,i,ht->hash(i));
+  ++ht->used;
+}
+
+/* a slot can be emptied rather than marked deleted if every group that contains it has an empty slot,
+ since probes stop at such groups */
+static void erase(struct hashtable *ht,int j) {
+  int mask=ht->tablen-1,after=match(load(ht->ctrl,j),EMPTY),before=match(load(ht->ctrl,(j-GROUP)&mask),EMPTY),n;
+  ht->table[j]=-1;
+  if(after&&before) {
+    for(n=0;!(after&1);after>>=1) ++n;
+    for(;!(before&(1<<(GROUP-1)));before<<=1) ++n;
+    if(n<GROUP) {set_ctrl(ht->ctrl,ht->tablen,j,EMPTY); return;}
+  }
+  set_ctrl(ht->ctrl,ht->tablen,j,DELETED); ++ht->deleted;
+}
+
+static int del(struct hashtable *ht,int i,int eq) {
+  int hv,j,tj;
+  if(ht->used==0) return -1;
+  hv=ht->hash(i);
+  step(ht);
+  if((j=find(ht,ht->table,ht->ctrl,ht->tablen,i,hv,eq))!=-1) {
+    tj=ht->table[j]; erase(ht,j);
+  } else if(ht->oldtable&&(j=find(ht,ht->oldtable,ht->oldctrl,ht->oldlen,i,hv,eq))!=-1) {
+    tj=ht->oldtable[j]; ht->oldtable[j]=-1;
+    set_ctrl(ht->oldctrl,ht->oldlen,j,DELETED); --ht->oldused;
+  } else return -1;
+  --ht->used;
+  return tj;
+}
 int ht_del(struct hashtable *ht,int i) {return del(ht,i,0);}
 int ht_deli(struct hashtable *ht,int i) {return del(ht,i,1);}
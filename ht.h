@@ -6,8 +6,12 @@
 struct hashtable {
   int (*hash)(int i);
   int (*equal)(int i1,int i2);
-  int tablen,used,limit;
+  int tablen,used,deleted,limit;
   int *table;
+  unsigned char *ctrl;
+  int oldlen,oldused,moved; /* the array being moved to table, if oldtable!=NULL */
+  int *oldtable;
+  unsigned char *oldctrl;
 };
 
 extern void ht_init(struct hashtable *ht,int len,int (*hash)(int),int (*equal)(int,int));
@@ -14,20 +14,43 @@
 #define RN_PRIME_NC 0xfb
 #define RN_LEN_S 256
 
+#define CM_LEN_M 256
+#define CM_PRIME_M 0x3fd
+#define CM_N_C 16
+#define CM_LIM 16
+
 #define SC_LEN 64
 
 #define RND_LEN_F 1024
+#define RND_LEN_RD 16
 
 #define DRV_LEN_DTL 4
 #define DRV_LEN_M 4096
 #define DRV_PRIME_M 0xffd
 #define DRV_LIM_M (8*DRV_LEN_M)
+#define DRV_LEN_PM 1024
+#define DRV_LEN_TR 1024
+#define DRV_LIM_TR (8*DRV_LEN_TR)
+#define DRV_LEN_NM 256
+#define DRV_LEN_V 256
+#define DRV_LIM_V (16*DRV_LEN_V)
+#define DRV_LEN_VS 32
+#define DRV_LEN_CX 256
+#define DRV_LIM_CX 16
+#define DRV_LEN_AL 256
+#define DRV_LEN_AS 256
+#define DRV_LIM_AS (16*DRV_LEN_AS)
+#define DRV_LEN_XS 256
+#define DRV_LIM_XS 4096
 
 #define RNX_LEN_EXP 16
 #define RNX_LIM_EXP 64
 
 #define XCL_LEN_T 1024
 #define XCL_LIM_T 16384
+#define XCL_LEN_O 1024
+#define XCL_LEN_K 64
+#define XCL_LIM_K 1024
 
 #define RX_LEN_P 256
 #define RX_PRIME_P 0xfb
@@ -39,5 +62,9 @@
 #define RX_LEN_M 1024
 #define RX_PRIME_M 0x3fd
 #define RX_LIM_M (8*RX_LEN_M)
+#define RX_LEN_D 64
+#define RX_PRIME_D 0x3f
+#define RX_LIM_D 1024
+#define RX_LEN_BM 64
 
 #endif
@@ -1,9 +1,10 @@
 /* $Id$ */
 
-#include <string.h> /* strcmp,strlen,strcpy*/
+#include <string.h> /* strcmp,strlen,strcpy,memcpy*/
 #include "m.h"
 #include "s.h" /* s_hval */
 #include "ht.h"
+#include "cm.h"
 #include "ll.h"
 #include "rn.h"
 #include "rnx.h"
@@ -27,21 +28,22 @@
 static int p_size[]={1,1,1,1,3,3,3,2,2,3,3,3,3,3,2,3};
 static int nc_size[]={1,3,2,1,3,3,3};
 
-int *rn_pattern;
-int *rn_nameclass;
-char *rn_string;
-int rn_empty,rn_text,rn_notAllowed,rn_dt_string,rn_dt_token,rn_xsd_uri;
+TH_LOCAL int *rn_pattern;
+TH_LOCAL int *rn_nameclass;
+TH_LOCAL char *rn_string;
+TH_LOCAL int rn_empty,rn_text,rn_notAllowed,rn_dt_string,rn_dt_token,rn_xsd_uri;
 
-static struct hashtable ht_p, ht_nc, ht_s;
+static TH_LOCAL struct hashtable ht_p, ht_nc, ht_s;
 
-static int i_p,i_nc,i_s,BASE_P,base_p,i_ref;
-static int len_p,len_nc,len_s;
-static int adding_ps;
+static TH_LOCAL int i_p,i_nc,i_s,BASE_P,base_p,i_ref;
+static TH_LOCAL int len_p,len_nc,len_s;
+static TH_LOCAL int adding_ps;
+static TH_LOCAL int gc_p; /* size of the pattern table after the last compression */
 
 void rn_new_schema(void) {base_p=i_p; i_ref=0;}
 
-void rn_del_p(int i) {ht_deli(&ht_p,i);}
-void rn_add_p(int i) {if(ht_get(&ht_p,i)==-1) ht_put(&ht_p,i);}
+void rn_del_p(int i) {ht_deli(&ht_p,i); cm_clear(CM_RN);}
+int rn_add_p(int i) {int q; if((q=ht_get(&ht_p,i))==-1) ht_put(&ht_p,q=i); return q;}
 
 int rn_contentType(int i) {return rn_pattern[i]&0x1C00;}
 void rn_setContentType(int i,int t1,int t2) {rn_pattern[i]|=(t1>t2?t1:t2);}
@@ -122,6 +124,8 @@ int rn_newChoice(int p1,int p2) { P_NEW(RN_P_CHOICE);
   rn_pattern[i_p+1]=p1; rn_pattern[i_p+2]=p2;
   rn_setNullable(i_p,rn_nullable(p1)||rn_nullable(p2));
   rn_setCdata(i_p,rn_cdata(p1)||rn_cdata(p2));
+  rn_setAttrs(i_p,rn_attrs(p1)||rn_attrs(p2));
+  rn_setElems(i_p,rn_elems(p1)||rn_elems(p2));
   return accept_p();
 }
 
@@ -129,6 +133,8 @@ int rn_newInterleave(int p1,int p2) { P_NEW(RN_P_INTERLEAVE);
   rn_pattern[i_p+1]=p1; rn_pattern[i_p+2]=p2;
   rn_setNullable(i_p,rn_nullable(p1)&&rn_nullable(p2));
   rn_setCdata(i_p,rn_cdata(p1)||rn_cdata(p2));
+  rn_setAttrs(i_p,rn_attrs(p1)||rn_attrs(p2));
+  rn_setElems(i_p,rn_elems(p1)||rn_elems(p2));
   return accept_p();
 }
 
@@ -136,6 +142,8 @@ int rn_newGroup(int p1,int p2) { P_NEW(RN_P_GROUP);
   rn_pattern[i_p+1]=p1; rn_pattern[i_p+2]=p2;
   rn_setNullable(i_p,rn_nullable(p1)&&rn_nullable(p2));
   rn_setCdata(i_p,rn_cdata(p1)||rn_cdata(p2));
+  rn_setAttrs(i_p,rn_attrs(p1)||rn_attrs(p2));
+  rn_setElems(i_p,rn_elems(p1)||rn_elems(p2));
   return accept_p();
 }
 
@@ -143,6 +151,8 @@ int rn_newOneOrMore(int p1) { P_NEW(RN_P_ONE_OR_MORE);
   rn_pattern[i_p+1]=p1;
   rn_setNullable(i_p,rn_nullable(p1));
   rn_setCdata(i_p,rn_cdata(p1));
+  rn_setAttrs(i_p,rn_attrs(p1));
+  rn_setElems(i_p,rn_elems(p1));
   return accept_p();
 }
 
@@ -173,17 +183,21 @@ int rn_newValue(int dt,int s) { P_NEW(RN_P_VALUE);
 
 int rn_newAttribute(int nc,int p1) { P_NEW(RN_P_ATTRIBUTE);
   rn_pattern[i_p+2]=nc; rn_pattern[i_p+1]=p1;
+  rn_setAttrs(i_p,1);
   return accept_p();
 }
 
 int rn_newElement(int nc,int p1) { P_NEW(RN_P_ELEMENT);
   rn_pattern[i_p+2]=nc; rn_pattern[i_p+1]=p1;
+  rn_setElems(i_p,1);
   return accept_p();
 }
 
 int rn_newAfter(int p1,int p2) { P_NEW(RN_P_AFTER);
   rn_pattern[i_p+1]=p1; rn_pattern[i_p+2]=p2;
   rn_setCdata(i_p,rn_cdata(p1));
+  rn_setAttrs(i_p,rn_attrs(p1));
+  rn_setElems(i_p,rn_elems(p1));
   return accept_p();
 }
 
@@ -207,14 +221,28 @@ int rn_group(int p1,int p2) {
   return rn_newGroup(p1,p2);
 }
 
+/* rn_choice adds alternatives to a chain of choices one at a time, and samechoice walks the chain;
+ the alternatives of long chains are kept in cm, so that a choice of k alternatives is built in O(k)
+ rather than O(k^2), even when several chains grow in turn */
 static int samechoice(int p1,int p2) {
-  if(RN_P_IS(p1,RN_P_CHOICE)) {
-    int p11,p12; rn_Choice(p1,p11,p12);
-    return p12==p2||samechoice(p11,p2);
-  } else return p1==p2;
+  int p,p11,p12,c,n=0;
+  if((c=cm_find(CM_RN,p1))!=-1) return cm_has(c,p2);
+  for(p=p1;RN_P_IS(p,RN_P_CHOICE);p=p11) {
+    rn_Choice(p,p11,p12);
+    if(p12==p2) return 1;
+    ++n;
+  }
+  if(p==p2) return 1;
+  if(n>=CM_LIM) {
+    c=cm_new(CM_RN,p1);
+    for(p=p1;RN_P_IS(p,RN_P_CHOICE);p=p11) {rn_Choice(p,p11,p12); cm_add(c,p12);}
+    cm_add(c,p);
+  }
+  return 0;
 }
 
 int rn_choice(int p1,int p2) {
+  int p,c;
   if(RN_P_IS(p1,RN_P_NOT_ALLOWED)) return p2;
   if(RN_P_IS(p2,RN_P_NOT_ALLOWED)) return p1;
   if(RN_P_IS(p2,RN_P_CHOICE)) {
@@ -224,6 +252,7 @@ int rn_choice(int p1,int p2) {
   if(samechoice(p1,p2)) return p1;
   if(rn_nullable(p1) && (RN_P_IS(p2,RN_P_EMPTY))) return p1;
   if(rn_nullable(p2) && (RN_P_IS(p1,RN_P_EMPTY))) return p2;
+  if((c=cm_find(CM_RN,p1))!=-1) {cm_add(c,p2); p=rn_newChoice(p1,p2); cm_move(c,p); return p;}
   return rn_newChoice(p1,p2);
 }
 
@@ -287,7 +316,7 @@ static int equal_s(int s1,int s2);
 
 static void windup(void);
 
-static int initialized=0;
+static TH_LOCAL int initialized=0;
 void rn_init(void) {
   if(!initialized) { initialized=1;
     rn_pattern=(int *)m_alloc(len_p=P_AVG_SIZE*LEN_P,sizeof(int));
@@ -296,6 +325,7 @@ void rn_init(void) {
     ht_init(&ht_p,LEN_P,&hash_p,&equal_p);
     ht_init(&ht_nc,LEN_NC,&hash_nc,&equal_nc);
     ht_init(&ht_s,LEN_S,&hash_s,&equal_s);
+    cm_init();
     windup();
   }
 }
@@ -306,7 +336,8 @@ void rn_clear(void) {
 }
 
 static void windup(void) {
-  i_p=i_nc=i_s=0;
+  cm_clear(CM_RN);
+  i_p=i_nc=i_s=gc_p=0;
   adding_ps=0;
   rn_pattern[0]=RN_P_ERROR;  accept_p();
   rn_nameclass[0]=RN_NC_ERROR; accept_nc();
@@ -321,14 +352,14 @@ static void windup(void) {
 }
 
 static int hash_p(int p) {
-  int *pp=rn_pattern+p; int h=0;
+  int *pp=rn_pattern+p; unsigned h=0;
   switch(p_size[RN_P_TYP(p)]) {
   case 1: h=pp[0]&0xF; break;
   case 2: h=(pp[0]&0xF)|(pp[1]<<4); break;
   case 3: h=(pp[0]&0xF)|((pp[1]^pp[2])<<4); break;
   default: assert(0);
   }
-  return h*PRIME_P;
+  return (int)(h*PRIME_P);
 }
 
 static int hash_nc(int nc) {
@@ -389,6 +420,7 @@ static void mark_p(int start,int since) {
     case RN_P_INTERLEAVE: rn_Interleave(p,p1,p2); goto BINARY;
     case RN_P_GROUP: rn_Group(p,p1,p2); goto BINARY;
     case RN_P_DATA_EXCEPT: rn_DataExcept(p,p1,p2); goto BINARY;
+    case RN_P_AFTER: rn_After(p,p1,p2); goto BINARY;
     BINARY: pick_p(p2); goto UNARY;
 
     case RN_P_ONE_OR_MORE: rn_OneOrMore(p,p1); goto UNARY;
@@ -438,6 +470,7 @@ static void sweep_p(int *starts,int n_st,int since) {
 	case RN_P_INTERLEAVE: rn_Interleave(p,p1,p2); goto BINARY;
 	case RN_P_GROUP: rn_Group(p,p1,p2); goto BINARY;
 	case RN_P_DATA_EXCEPT: rn_DataExcept(p,p1,p2); goto BINARY;
+	case RN_P_AFTER: rn_After(p,p1,p2); goto BINARY;
 	BINARY:
 	  if(p2>=since && (q=xlat[p2-since])!=p2) {
 	    ht_deli(&ht_p,p);
@@ -512,6 +545,7 @@ static void compress_p(int *starts,int n_st,int since) {
       case RN_P_INTERLEAVE: rn_Interleave(p,p1,p2); goto BINARY;
       case RN_P_GROUP: rn_Group(p,p1,p2); goto BINARY;
       case RN_P_DATA_EXCEPT: rn_DataExcept(p,p1,p2); goto BINARY;
+      case RN_P_AFTER: rn_After(p,p1,p2); goto BINARY;
       BINARY:
 	if(p2>=since && (q=xlat[p2-since])!=p2) rn_pattern[p+2]=q;
 	goto UNARY;
@@ -552,16 +586,144 @@ static void compress_p(int *starts,int n_st,int since) {
 
 void rn_compress(int *starts,int n_st) {
   int i;
+  cm_clear(CM_RN);
   for(i=0;i!=n_st;++i) mark_p(starts[i],BASE_P);
   sweep_p(starts,n_st,BASE_P);
   unmark_p(BASE_P);
   compress_p(starts,n_st,BASE_P);
+  gc_p=i_p;
 }
 
 int rn_compress_last(int start) {
+  cm_clear(CM_RN);
   mark_p(start,base_p);
   sweep_p(&start,1,base_p);
   unmark_p(base_p);
   compress_p(&start,1,base_p);
+  gc_p=i_p;
   return start;
 }
+
+int rn_collect(int *roots,int n_roots) {
+  if(i_p-gc_p<P_AVG_SIZE*LIM_P||i_p-gc_p<gc_p) return 0;
+  rn_compress(roots,n_roots);
+  return 1;
+}
+
+void rn_save(struct rn_schema *sp) {
+  int *pattern,*nameclass; char *string;
+  pattern=(int*)m_alloc(sp->n_p=i_p,sizeof(int)); memcpy(pattern,rn_pattern,i_p*sizeof(int));
+  nameclass=(int*)m_alloc(sp->n_nc=i_nc,sizeof(int)); memcpy(nameclass,rn_nameclass,i_nc*sizeof(int));
+  string=(char*)m_alloc(sp->n_s=i_s,sizeof(char)); memcpy(string,rn_string,i_s*sizeof(char));
+  sp->pattern=pattern; sp->nameclass=nameclass; sp->string=string;
+}
+
+/* kinds of the operands of patterns and name classes, in the order of their fields */
+#define OPD_P 1
+#define OPD_NC 2
+#define OPD_S 3
+static char p_opd[][2]={
+  {0,0},{0,0},{0,0},{0,0},{OPD_P,OPD_P},{OPD_P,OPD_P},{OPD_P,OPD_P},{OPD_P,0},
+  {OPD_P,0},{OPD_NC,OPD_S},{OPD_P,OPD_P},{OPD_NC,OPD_S},{OPD_P,OPD_NC},{OPD_P,OPD_NC},{OPD_P,0},{OPD_P,OPD_P}};
+static char nc_opd[][2]={{0,0},{OPD_S,OPD_S},{OPD_S,0},{0,0},{OPD_NC,OPD_NC},{OPD_NC,OPD_NC},{OPD_S,OPD_S}};
+
+/* marks the first slot of each record in rec; 0 if the table is not a sequence of whole records */
+static int records(const int *tbl,int n,int *size,int n_typ,char *rec) {
+  int i=0,t;
+  memset(rec,0,n);
+  while(i!=n) {
+    if((t=tbl[i]&0xFF)>=n_typ||size[t]>n-i) return 0;
+    rec[i]=1; i+=size[t];
+  }
+  return 1;
+}
+
+static int operand(const struct rn_schema *sp,int kind,int x,char *rec_p,char *rec_nc) {
+  switch(kind) {
+  case OPD_P: return 0<=x&&x<sp->n_p&&rec_p[x];
+  case OPD_NC: return 0<=x&&x<sp->n_nc&&rec_nc[x];
+  case OPD_S: return 0<=x&&x<sp->n_s;
+  default: assert(0);
+  }
+  return 0;
+}
+
+/* operand k of record i that derivatives follow without passing an element, or -1 */
+static int follow_p(const struct rn_schema *sp,int p,int k) {
+  int t=sp->pattern[p]&0xFF;
+  return p_opd[t][k]==OPD_P&&t!=RN_P_ELEMENT?sp->pattern[p+1+k]:-1;
+}
+static int follow_nc(const struct rn_schema *sp,int nc,int k) {
+  return nc_opd[sp->nameclass[nc]&0xFF][k]==OPD_NC?sp->nameclass[nc+1+k]:-1;
+}
+
+/* depth-first search with an explicit stack, since a corrupt table may nest as deep as it is long;
+ rec is 1 for unvisited records, 2 for records on the stack and 3 for finished ones */
+static int acyclic(const struct rn_schema *sp,int n,int (*follow)(const struct rn_schema*,int,int),char *rec) {
+  int *stk,n_stk,i,j,k,ok=1;
+  stk=(int*)m_alloc(2*n,sizeof(int));
+  for(i=0;ok&&i!=n;++i) if(rec[i]==1) {
+    n_stk=0; stk[n_stk++]=i; stk[n_stk++]=0; rec[i]=2;
+    while(n_stk) {
+      j=stk[n_stk-2]; k=stk[n_stk-1];
+      if(k==2) {rec[j]=3; n_stk-=2; continue;}
+      ++stk[n_stk-1];
+      if((j=follow(sp,j,k))==-1||rec[j]==3) continue;
+      if(rec[j]==2) {ok=0; break;}
+      rec[j]=2; stk[n_stk++]=j; stk[n_stk++]=0;
+    }
+  }
+  m_free(stk);
+  return ok;
+}
+
+int rn_check(const struct rn_schema *sp,int start) {
+  char *rec_p,*rec_nc; int i,k,t,ok,n_s0;
+  rn_init();
+  n_s0=rn_xsd_uri+strlen(rn_string+rn_xsd_uri)+1;
+  if(sp->n_p<BASE_P||sp->n_nc<rn_dt_token+NC_SIZE||sp->n_s<n_s0||sp->string[sp->n_s-1]!='\0') return 0;
+  for(i=0;i!=BASE_P;++i) if((sp->pattern[i]&0xFF)!=RN_P_TYP(i)) return 0; /* the flags of the first patterns are set by rnd */
+  if(memcmp(sp->nameclass,rn_nameclass,(rn_dt_token+NC_SIZE)*sizeof(int))!=0
+    ||memcmp(sp->string,rn_string,n_s0)!=0) return 0;
+  rec_p=(char*)m_alloc(sp->n_p,sizeof(char)); rec_nc=(char*)m_alloc(sp->n_nc,sizeof(char));
+  ok=records(sp->pattern,sp->n_p,p_size,RN_P_AFTER+1,rec_p)
+    &&records(sp->nameclass,sp->n_nc,nc_size,RN_NC_DATATYPE+1,rec_nc)
+    &&BASE_P<=start&&start<sp->n_p&&rec_p[start];
+  for(i=0;ok&&i!=sp->n_p;++i) if(rec_p[i]) {
+    t=sp->pattern[i]&0xFF;
+    for(k=0;ok&&k!=2&&p_opd[t][k];++k) ok=operand(sp,p_opd[t][k],sp->pattern[i+1+k],rec_p,rec_nc);
+  }
+  for(i=0;ok&&i!=sp->n_nc;++i) if(rec_nc[i]) {
+    t=sp->nameclass[i]&0xFF;
+    for(k=0;ok&&k!=2&&nc_opd[t][k];++k) ok=operand(sp,nc_opd[t][k],sp->nameclass[i+1+k],rec_p,rec_nc);
+  }
+  ok=ok&&acyclic(sp,sp->n_p,&follow_p,rec_p)&&acyclic(sp,sp->n_nc,&follow_nc,rec_nc);
+  m_free(rec_p); m_free(rec_nc);
+  return ok;
+}
+
+/* replaces the tables with a copy of the image and rebuilds the hash tables;
+ the datatype libraries and memo tables refer to the tables, hence drv_init
+ is called after rn_load */
+void rn_load(const struct rn_schema *sp) {
+  int p,nc,s;
+  rn_init();
+  if(sp->n_p+P_SIZE>len_p) {m_free(rn_pattern); rn_pattern=(int*)m_alloc(len_p=2*(sp->n_p+P_SIZE),sizeof(int));}
+  if(sp->n_nc+NC_SIZE>len_nc) {m_free(rn_nameclass); rn_nameclass=(int*)m_alloc(len_nc=2*(sp->n_nc+NC_SIZE),sizeof(int));}
+  if(sp->n_s>len_s) {m_free(rn_string); rn_string=(char*)m_alloc(len_s=2*sp->n_s,sizeof(char));}
+  memcpy(rn_pattern,sp->pattern,sp->n_p*sizeof(int));
+  memcpy(rn_nameclass,sp->nameclass,sp->n_nc*sizeof(int));
+  memcpy(rn_string,sp->string,sp->n_s*sizeof(char));
+  ht_clear(&ht_p); ht_clear(&ht_nc); ht_clear(&ht_s); cm_clear(CM_RN);
+  i_p=sp->n_p; i_nc=sp->n_nc; i_s=sp->n_s;
+  for(p=0;p!=i_p;p+=p_size[RN_P_TYP(p)]) {
+    if(!RN_P_IS(p,RN_P_REF)&&ht_get(&ht_p,p)==-1) ht_put(&ht_p,p);
+  }
+  for(nc=0;nc!=i_nc;nc+=nc_size[RN_NC_TYP(nc)]) {
+    if(ht_get(&ht_nc,nc)==-1) ht_put(&ht_nc,nc);
+  }
+  for(s=0;s!=i_s;s+=strlen(rn_string+s)+1) {
+    if(ht_get(&ht_s,s)==-1) ht_put(&ht_s,s);
+  }
+  base_p=gc_p=i_p; i_ref=0; adding_ps=0;
+}
@@ -4,6 +4,7 @@
 #define RN_H 1
 
 #include <assert.h>
+#include "th.h"
 
 /* Patterns */
 #define RN_P_ERROR 0
@@ -42,6 +43,8 @@ them to variables in the local scope, and a creator.
 #define RN_P_FLG_CTE 0x00000400
 #define RN_P_FLG_CTC 0x00000800
 #define RN_P_FLG_CTS 0x00001000
+#define RN_P_FLG_ATT 0x00002000
+#define RN_P_FLG_ELM 0x00004000
 #define RN_P_FLG_ERS 0x40000000
 #define RN_P_FLG_MRK 0x80000000
 
@@ -55,6 +58,12 @@ them to variables in the local scope, and a creator.
 #define rn_cdata(i) rn_pattern[i]&RN_P_FLG_TXT
 #define rn_setCdata(i,x) if(x) rn_pattern[i]|=RN_P_FLG_TXT
 
+/* the pattern can match an attribute or an element; derivatives of patterns that cannot are notAllowed */
+#define rn_attrs(i) (rn_pattern[i]&RN_P_FLG_ATT)
+#define rn_setAttrs(i,x) if(x) rn_pattern[i]|=RN_P_FLG_ATT
+#define rn_elems(i) (rn_pattern[i]&RN_P_FLG_ELM)
+#define rn_setElems(i,x) if(x) rn_pattern[i]|=RN_P_FLG_ELM
+
 /* assert: p1 at 1, p2 at 2 */
 
 #define rn_NotAllowed(i) RN_P_CHK(i,RN_P_NOT_ALLOWED)
@@ -94,12 +103,23 @@ them to variables in the local scope, and a creator.
 #define rn_NameClassChoice(i,nc1,nc2) RN_NC_CHK(i,RN_NC_CHOICE); nc1=rn_nameclass[i+1]; nc2=rn_nameclass[i+2]
 #define rn_Datatype(i,lib,typ) RN_NC_CHK(i,RN_NC_DATATYPE); lib=rn_nameclass[i+1]; typ=rn_nameclass[i+2]
 
-extern int rn_empty,rn_text,rn_notAllowed,rn_dt_string,rn_dt_token,rn_xsd_uri;
+extern TH_LOCAL int rn_empty,rn_text,rn_notAllowed,rn_dt_string,rn_dt_token,rn_xsd_uri;
+
+extern TH_LOCAL char *rn_string;
 
-extern char *rn_string;
+extern TH_LOCAL int *rn_pattern;
+extern TH_LOCAL int *rn_nameclass;
 
-extern int *rn_pattern;
-extern int *rn_nameclass;
+/* compiled schema: pattern, name class and string tables as they are after loading;
+ the image is not modified during validation, and each thread validating against
+ it works on a copy made with rn_load, since derived patterns are appended to the
+ tables; memory thus grows with the number of threads by the size of the schema.
+ rnv -C writes an image as C source */
+struct rn_schema {
+  const int *pattern,*nameclass;
+  const char *string;
+  int n_p,n_nc,n_s;
+};
 
 extern void rn_new_schema(void);
 
@@ -108,7 +128,7 @@ extern void rn_setContentType(int i,int t1,int t2);
 extern int rn_groupable(int p1,int p2);
 
 extern void rn_del_p(int i);
-extern void rn_add_p(int i);
+extern int rn_add_p(int i); /* i, or the pattern equal to it that is there already */
 
 extern int rn_newString(char *s);
 
@@ -153,4 +173,19 @@ extern void rn_clear(void);
 extern void rn_compress(int *starts,int n);
 extern int rn_compress_last(int start);
 
+/* discards patterns unreachable from roots once the table has grown enough since
+ the last compression; returns 1 if it did, and then the numbers of derived patterns,
+ including those in roots, change, and whatever refers to patterns must be forgotten.
+ Patterns of loaded schemas keep their numbers if all start patterns are in roots. */
+extern int rn_collect(int *roots,int n_roots);
+
+extern void rn_save(struct rn_schema *sp);
+extern void rn_load(const struct rn_schema *sp);
+
+/* checks an image that does not come from rn_save in this process, before rn_load:
+ returns 0 unless the tables consist of whole records whose operands refer to records
+ of the right table, start is a pattern of the schema, and patterns refer back to
+ themselves only through the content of elements */
+extern int rn_check(const struct rn_schema *sp,int start);
+
 #endif
@@ -117,10 +117,14 @@ void (*rnc_verror_handler)(int er_no,va_list ap)=&rnc_default_verror_handler;
 #define NXT(sp) ((sp)->sym[!(sp)->cur])
 
 #define LEN_P 128
+#define LEN_F 16
 
 static int len_p;
 static char *path;
 
+char **rnc_files; int rnc_n_files;
+static int len_f;
+
 static void rnc_source_init(struct rnc_source *sp,char *fn);
 static int rnc_read(struct rnc_source *sp);
 
@@ -145,6 +149,8 @@ static void error(int force,struct rnc_source *sp,int er_no,...);
 int rnc_open(struct rnc_source *sp,char *fn) {
   int fd=rnc_bind(sp,fn,open(fn,O_RDONLY)); if(fd==-1) error(1,sp,RNC_ER_IO,sp->fn,-1,-1,strerror(errno));
   sp->flags|=SRC_CLOSE;
+  if(rnc_n_files==len_f) rnc_files=(char**)m_stretch(rnc_files,len_f=2*rnc_n_files,rnc_n_files,sizeof(char*));
+  rnc_files[rnc_n_files++]=s_clone(fn);
   return fd;
 }
 
@@ -210,6 +216,7 @@ void rnc_init(void) {
   if(!initialized) { initialized=1;
     rn_init();
     len_p=LEN_P; path=(char*)m_alloc(len_p,sizeof(char));
+    rnc_files=(char**)m_alloc(len_f=LEN_F,sizeof(char*)); rnc_n_files=0;
     /* initialize scopes */
     sc_init(&nss); sc_init(&dts); sc_init(&defs); sc_init(&refs); sc_init(&prefs);
   }
@@ -217,6 +224,10 @@ void rnc_init(void) {
 
 void rnc_clear(void) {}
 
+void rnc_clear_files(void) {
+  while(rnc_n_files) m_free(rnc_files[--rnc_n_files]);
+}
+
 static void error(int force,struct rnc_source *sp,int erno,...) {
   if(force || sp->line != sp->prevline) {
     va_list ap; va_start(ap,erno); (*rnc_verror_handler)(erno,ap); va_end(ap);
@@ -54,6 +54,10 @@ extern void rnc_default_verror_handler(int erno,va_list ap);
 extern void rnc_init(void);
 extern void rnc_clear(void);
 
+/* names of the files opened with rnc_open since rnc_clear_files, the grammar and the included grammars */
+extern char **rnc_files; extern int rnc_n_files;
+extern void rnc_clear_files(void);
+
 extern int rnc_open(struct rnc_source *sp,char *fn);
 extern int rnc_stropen(struct rnc_source *sp,char *fn,char *s,int len);
 extern int rnc_bind(struct rnc_source *sp,char *fn,int fd);
@@ -10,6 +10,7 @@
 #include "rnd.h"
 
 #define LEN_F RND_LEN_F
+#define LEN_RD RND_LEN_RD
 
 static int len_f,n_f;
 static int *flat;
@@ -420,9 +421,125 @@ static void cdatas(void) {
   } while(changed);
 }
 
+static void contents(void) {
+  int i,p,p1,p2,flg,changed;
+  do {
+    changed=0;
+    for(i=0;i!=n_f;++i) {
+      p=flat[i];
+      switch(RN_P_TYP(p)) {
+      case RN_P_NOT_ALLOWED: case RN_P_EMPTY: case RN_P_TEXT:
+      case RN_P_DATA: case RN_P_DATA_EXCEPT: case RN_P_VALUE: case RN_P_LIST:
+      case RN_P_ATTRIBUTE: case RN_P_ELEMENT:
+	continue;
+
+      case RN_P_CHOICE: rn_Choice(p,p1,p2); goto BINARY;
+      case RN_P_INTERLEAVE: rn_Interleave(p,p1,p2); goto BINARY;
+      case RN_P_GROUP: rn_Group(p,p1,p2); goto BINARY;
+      BINARY:
+	flg=(rn_pattern[p1]|rn_pattern[p2])&(RN_P_FLG_ATT|RN_P_FLG_ELM); break;
+
+      case RN_P_ONE_OR_MORE: rn_OneOrMore(p,p1); flg=rn_pattern[p1]&(RN_P_FLG_ATT|RN_P_FLG_ELM); break;
+
+      default: assert(0);
+      }
+      if(flg&~rn_pattern[p]) {rn_pattern[p]|=flg; changed=1;}
+    }
+  } while(changed);
+}
+
 static void traits(void) {
   nullables();
   cdatas();
+  contents();
+}
+
+/* a & b & c ... is parsed into a chain of binary interleaves as deep as the number of members;
+ a derivative rebuilds the chain above the member it consumes, and every new state of the interleave
+ misses the memo at each of those nodes. Chains are rebuilt as balanced trees of the same members,
+ in the same order, so that a derivative touches a logarithmic number of nodes */
+static int *ms,len_ms,n_ms;
+static int (*rd)[2],len_rd,n_rd; /* rebuilt patterns that are equal to patterns already there */
+
+static void members(int p) {
+  int p1,p2;
+  if(RN_P_IS(p,RN_P_INTERLEAVE)) {
+    rn_Interleave(p,p1,p2); members(p1); members(p2);
+  } else {
+    if(n_ms==len_ms) ms=(int*)m_stretch(ms,len_ms=2*n_ms,n_ms,sizeof(int));
+    ms[n_ms++]=p;
+  }
+}
+
+static int balance(int lo,int hi) {
+  int mid=(lo+hi)/2;
+  return hi-lo==1?ms[lo]:rn_ileave(balance(lo,mid),balance(mid,hi));
+}
+
+static void root(int p) {if(RN_P_IS(p,RN_P_INTERLEAVE)) rn_mark(p);}
+
+/* p has got new operands; if another pattern is now equal to it, references to p go there */
+static void rebuilt(int p) {
+  int q=rn_add_p(p);
+  if(q!=p) {
+    if(n_rd==len_rd) rd=(int(*)[2])m_stretch(rd,len_rd=2*n_rd,n_rd,sizeof(int[2]));
+    rd[n_rd][0]=p; rd[n_rd][1]=q; ++n_rd;
+    rn_mark(p);
+  }
+}
+
+static int redirect(int p) {
+  int i;
+  if(rn_marked(p)) for(i=0;i!=n_rd;++i) if(rd[i][0]==p) return rd[i][1];
+  return p;
+}
+
+static void ileaves(void) {
+  int i,p,p1,p2,q,n,changed;
+  /* only the roots of chains, interleaves that are not operands of interleaves, are rebuilt;
+   the inner nodes of a chain are left to the garbage collector */
+  root(flat[0]);
+  for(i=0;i!=n_f;++i) {
+    p=flat[i];
+    switch(RN_P_TYP(p)) {
+    case RN_P_CHOICE: case RN_P_GROUP: case RN_P_DATA_EXCEPT: root(rn_pattern[p+2]); /* fall through */
+    case RN_P_ONE_OR_MORE: case RN_P_LIST: case RN_P_ATTRIBUTE: case RN_P_ELEMENT: root(rn_pattern[p+1]); break;
+    }
+  }
+  ms=(int*)m_alloc(len_ms=LEN_F,sizeof(int));
+  rd=(int(*)[2])m_alloc(len_rd=LEN_RD,sizeof(int[2])); n_rd=0;
+  for(i=0;i!=n_f;++i) {
+    p=flat[i];
+    if(rn_marked(p)) {
+      rn_unmark(p);
+      n_ms=0; members(p);
+      if(n_ms>3) {
+	p1=balance(0,n_ms/2); p2=balance(n_ms/2,n_ms);
+	rn_del_p(p); rn_pattern[p+1]=p1; rn_pattern[p+2]=p2; rebuilt(p);
+      }
+    }
+  }
+  /* operands are redirected until no more patterns become equal */
+  do {
+    n=n_rd;
+    for(i=0;i!=n_f;++i) {
+      p=flat[i];
+      if(rn_marked(p)) continue;
+      changed=0;
+      switch(RN_P_TYP(p)) {
+      case RN_P_CHOICE: case RN_P_INTERLEAVE: case RN_P_GROUP: case RN_P_DATA_EXCEPT:
+	if((q=redirect(rn_pattern[p+2]))!=rn_pattern[p+2]) {rn_del_p(p); rn_pattern[p+2]=q; changed=1;}
+	/* fall through */
+      case RN_P_ONE_OR_MORE: case RN_P_LIST: case RN_P_ATTRIBUTE: case RN_P_ELEMENT:
+	if((q=redirect(rn_pattern[p+1]))!=rn_pattern[p+1]) {if(!changed) rn_del_p(p); rn_pattern[p+1]=q; changed=1;}
+	if(changed) rebuilt(p);
+	break;
+      }
+    }
+  } while(n!=n_rd);
+  while(rn_marked(flat[0])) flat[0]=redirect(flat[0]);
+  for(i=0;i!=n_rd;++i) rn_unmark(rd[i][0]);
+  m_free(rd); m_free(ms);
 }
 
 static int release(void) {
@@ -433,6 +550,6 @@ static int release(void) {
 
 int rnd_fixup(int start) {
   errors=0; deref(start);
-  if(!errors) {restrictions(); if(!errors) traits();}
+  if(!errors) {restrictions(); if(!errors) {traits(); ileaves();}}
   start=release(); return errors?0:start;
 }
@@ -1,12 +1,35 @@
 /* $Id$ */
 
 #include <stdarg.h>
+#include <fcntl.h> /*open,close*/
+#include <sys/types.h>
+#include <sys/stat.h> /*stat,fstat,umask,fchmod*/
+#include UNISTD_H /*read,write,close,unlink*/
+#include <stdlib.h> /*mkstemp*/
+#include <stdio.h> /*rename*/
+#include <string.h> /*strcmp,strlen,strcpy,strcat*/
+#if RNL_MMAP
+#include <sys/mman.h> /*mmap,munmap*/
+#endif
+#include "m.h"
 #include "erbit.h"
 #include "rn.h"
 #include "rnc.h"
 #include "rnd.h"
 #include "rnl.h"
 
+/* the image is a header {magic,version,start,n_p,n_nc,n_s,n_f,hash},
+ n_f entries {size,hash,len} each followed by the file name, 0-padded to len ints,
+ and the pattern, name class and string tables, the last 0-padded to whole ints;
+ the hash in the header is of the tables. An image that does not fit its file,
+ has another hash or fails rn_check is ignored */
+#define IMG_MAGIC 0x524e5643
+#define IMG_VERSION 3
+#define IMG_HDR 8
+#define IMG_ENT 3
+
+char *rnl_image=NULL;
+
 void rnl_default_verror_handler(int erno,va_list ap) {
   if(erno&ERBIT_RNC) {
     rnc_default_verror_handler(erno&~ERBIT_RNC,ap);
@@ -39,9 +62,127 @@ static int load(struct rnc_source *sp) {
   return start;
 }
 
+/* FNV-1a */
+#define HASH_0 2166136261u
+static unsigned hash(unsigned h,const void *buf,size_t n) {
+  const unsigned char *s=(const unsigned char*)buf;
+  while(n--) h=(h^*s++)*16777619u;
+  return h;
+}
+
+static int hash_schema(struct rn_schema *sp) {
+  unsigned h=hash(HASH_0,sp->pattern,sp->n_p*sizeof(int));
+  h=hash(h,sp->nameclass,sp->n_nc*sizeof(int));
+  return (int)hash(h,sp->string,sp->n_s);
+}
+
+/* the hash of the file's contents, -1 if it cannot be read */
+static int hash_file(char *fn) {
+  char buf[1024]; int fd,n; unsigned h=HASH_0;
+  if((fd=open(fn,O_RDONLY))==-1) return -1;
+  while((n=read(fd,buf,sizeof(buf)))>0) h=hash(h,buf,n);
+  close(fd);
+  return n==-1?-1:(int)h;
+}
+
+/* a file is up to date if it has the same size and the same contents; modification times
+ are not trusted, since a file rewritten within a second keeps its time */
+static int fresh(char *fn,int *ent) {
+  struct stat st;
+  if(stat(fn,&st)==-1||(int)st.st_size!=ent[0]) return 0;
+  return hash_file(fn)==ent[1];
+}
+
+/* offsets are compared with what is left of the file, n-i, which does not overflow */
+static int load_image(char *fn) {
+  int fd,start=0,*img; size_t n,i,k; struct stat st;
+  if((fd=open(rnl_image,O_RDONLY))==-1) return 0;
+  if(fstat(fd,&st)==-1||(size_t)st.st_size<IMG_HDR*sizeof(int)) {close(fd); return 0;}
+  n=(size_t)st.st_size/sizeof(int);
+#if RNL_MMAP
+  img=(int*)mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0); close(fd);
+  if(img==(int*)MAP_FAILED) return 0;
+#else
+  img=(int*)m_alloc(n,sizeof(int));
+  k=read(fd,img,n*sizeof(int)); close(fd);
+  if(k!=n*sizeof(int)) goto END;
+#endif
+  if(img[0]!=IMG_MAGIC||img[1]!=IMG_VERSION||img[6]<1) goto END;
+  i=IMG_HDR;
+  for(k=0;k!=(size_t)img[6];++k) {
+    if(n-i<IMG_ENT||img[i+2]<1||n-i-IMG_ENT<(size_t)img[i+2]) goto END;
+    if(((char*)(img+i+IMG_ENT+img[i+2]))[-1]!='\0') goto END;
+    if(k==0&&strcmp((char*)(img+i+IMG_ENT),fn)!=0) goto END;
+    if(!fresh((char*)(img+i+IMG_ENT),img+i)) goto END;
+    i+=IMG_ENT+img[i+2];
+  }
+  if(img[3]<1||img[4]<1||img[5]<1) goto END;
+  if(n-i<(size_t)img[3]||n-i-img[3]<(size_t)img[4]||(n-i-img[3]-img[4])*sizeof(int)<(size_t)img[5]) goto END;
+  { struct rn_schema sc;
+    sc.pattern=img+i; sc.nameclass=img+i+img[3]; sc.string=(char*)(img+i+img[3]+img[4]);
+    sc.n_p=img[3]; sc.n_nc=img[4]; sc.n_s=img[5];
+    if(hash_schema(&sc)==img[7]&&rn_check(&sc,img[2])) {rn_load(&sc); start=img[2];}
+  }
+END:
+#if RNL_MMAP
+  munmap((void*)img,st.st_size);
+#else
+  m_free(img);
+#endif
+  return start;
+}
+
+static int write_ints(int fd,int *a,int n) {return write(fd,a,n*sizeof(int))==n*(int)sizeof(int);}
+
+/* the image is written to a temporary file of its own and renamed, so that concurrent readers see
+ whole images and concurrent writers do not write into each other's files; failures leave no image */
+static int open_tmp(char *tmp) {
+#if HAVE_MKSTEMP
+  int fd; mode_t m;
+  strcat(tmp,".XXXXXX");
+  if((fd=mkstemp(tmp))!=-1) {m=umask(0); umask(m); fchmod(fd,0666&~m);}
+  return fd;
+#else /* writers share the file */
+  strcat(tmp,".tmp");
+  return open(tmp,O_WRONLY|O_CREAT|O_TRUNC,0666);
+#endif
+}
+
+static void save_image(int start) {
+  struct rn_schema sc; struct stat st;
+  int fd,i,ok,hdr[IMG_HDR],ent[IMG_ENT]; char *tmp;
+  tmp=(char*)m_alloc(strlen(rnl_image)+8,sizeof(char)); strcpy(tmp,rnl_image);
+  if((fd=open_tmp(tmp))==-1) {m_free(tmp); return;}
+  rn_save(&sc);
+  hdr[0]=IMG_MAGIC; hdr[1]=IMG_VERSION; hdr[2]=start;
+  hdr[3]=sc.n_p; hdr[4]=sc.n_nc; hdr[5]=sc.n_s; hdr[6]=rnc_n_files; hdr[7]=hash_schema(&sc);
+  ok=write_ints(fd,hdr,IMG_HDR);
+  for(i=0;ok&&i!=rnc_n_files;++i) {
+    char *name=rnc_files[i]; int len=strlen(name)/sizeof(int)+1,*s;
+    if(stat(name,&st)==-1) {ok=0; break;}
+    ent[0]=(int)st.st_size; ent[1]=hash_file(name); ent[2]=len;
+    s=(int*)m_alloc(len,sizeof(int)); s[len-1]=0; strcpy((char*)s,name);
+    ok=write_ints(fd,ent,IMG_ENT)&&write_ints(fd,s,len);
+    m_free(s);
+  }
+  ok=ok&&write_ints(fd,(int*)sc.pattern,sc.n_p)&&write_ints(fd,(int*)sc.nameclass,sc.n_nc)
+    &&write(fd,sc.string,sc.n_s)==sc.n_s;
+  if(ok&&sc.n_s%sizeof(int)) { int pad=0,n_pad=sizeof(int)-sc.n_s%sizeof(int);
+    ok=write(fd,&pad,n_pad)==n_pad;
+  }
+  ok=close(fd)==0&&ok;
+  if(!(ok&&rename(tmp,rnl_image)==0)) unlink(tmp);
+  m_free(tmp);
+  m_free((int*)sc.pattern); m_free((int*)sc.nameclass); m_free((char*)sc.string);
+}
+
 int rnl_fn(char *fn) {
-  struct rnc_source src;
-  rnc_open(&src,fn); return load(&src);
+  struct rnc_source src; int start;
+  if(rnl_image&&(start=load_image(fn))) return start;
+  rnc_clear_files();
+  rnc_open(&src,fn); start=load(&src);
+  if(rnl_image&&start) save_image(start);
+  return start;
 }
 
 int rnl_fd(char *fn,int fd) {
@@ -6,6 +6,9 @@
 extern void (*rnl_verror_handler)(int er_no,va_list ap);
 extern void rnl_default_verror_handler(int erno,va_list ap);
 
+/* if set, rnl_fn loads the compiled grammar from this image when it is up to date, and writes it otherwise */
+extern char *rnl_image;
+
 extern void rnl_init(void);
 extern void rnl_clear(void);
 
@@ -3,13 +3,14 @@
 #include <string.h> /*strncpy,strrchr*/
 #include <assert.h>
 #include "m.h"
+#include "th.h"
 #include "xmlc.h" /*xmlc_white_space*/
 #include "erbit.h"
 #include "drv.h"
 #include "er.h"
 #include "rnv.h"
 
-extern int rn_notAllowed;
+extern TH_LOCAL int rn_notAllowed;
 
 #define err(msg) (*er_vprintf)(msg"\n",ap);
 void rnv_default_verror_handler(int erno,va_list ap) {
@@ -30,7 +31,7 @@ void rnv_default_verror_handler(int erno,va_list ap) {
   }
 }
 
-void (*rnv_verror_handler)(int erno,va_list ap)=&rnv_default_verror_handler;
+TH_LOCAL void (*rnv_verror_handler)(int erno,va_list ap)=&rnv_default_verror_handler;
 
 static void error_handler(int erno,...) {
   va_list ap; va_start(ap,erno); (*rnv_verror_handler)(erno,ap); va_end(ap);
@@ -39,7 +40,7 @@ static void error_handler(int erno,...) {
 static void verror_handler_drv(int erno,va_list ap) {(*rnv_verror_handler)(erno|ERBIT_DRV,ap);}
 
 static void windup(void);
-static int initialized=0;
+static TH_LOCAL int initialized=0;
 void rnv_init(void) {
   if(!initialized) {initialized=1;
     drv_init(); drv_verror_handler=&verror_handler_drv;
@@ -136,15 +137,41 @@ int rnv_start_tag_close(int *curp,int *prevp,char *name) {
   return ok;
 }
 
+/* returns -1 if the attributes must be matched one by one */
+static int attribute_list(int *curp,int *prevp,char **attrs) {
+  int ok=1,i,p,ret; char *suri,*sname,*sep,**a;
+  if(!drv_attribute_list_open(*curp)) return -1;
+  for(a=attrs;*a;a+=2) {
+    sep=qname_open(&suri,&sname,*a);
+    ret=drv_attribute_list_name(suri,sname);
+    qname_close(sep);
+    if(!ret) return -1;
+  }
+  if(!(ret=drv_attribute_list_close())) return -1;
+  for(i=0,a=attrs;*a;++i,a+=2) {
+    if((p=drv_attribute_list_value(i,*(a+1),strlen(*(a+1))))) { ok=0;
+      *prevp=p;
+      sep=qname_open(&suri,&sname,*a);
+      error_handler(RNV_ER_AVAL,suri,sname,*(a+1));
+      qname_close(sep);
+    }
+  }
+  *prevp=*curp; *curp=ret;
+  return ok;
+}
+
 int rnv_start_tag(int *curp,int *prevp,char *name,char **attrs) {
-  int ok=1;
+  int ok=1,p,a=0;
   ok=rnv_start_tag_open(curp,prevp,name)&&ok;
+  if(*curp!=rn_notAllowed&&*attrs&&(a=attribute_list(curp,prevp,attrs))!=-1) return a&&ok;
+  p=*curp;
   while(*curp!=rn_notAllowed) {
     if(!(*attrs)) break;
     ok = rnv_attribute(curp,prevp,*attrs,*(attrs+1))&&ok;
     attrs+=2;
   }
   if(*curp!=rn_notAllowed) ok=rnv_start_tag_close(curp,prevp,name)&&ok;
+  if(ok&&a==-1) drv_attribute_list_put(p,*curp);
   return ok;
 }
 
@@ -1,6 +1,7 @@
 /* $Id$ */
 
 #include <stdarg.h>
+#include "th.h"
 
 #ifndef RNV_H
 #define RNV_H 1
@@ -14,7 +15,7 @@
 #define RNV_ER_TEXT 6
 #define RNV_ER_NOTX 7
 
-extern void (*rnv_verror_handler)(int erno,va_list ap);
+extern TH_LOCAL void (*rnv_verror_handler)(int erno,va_list ap);
 
 extern void rnv_default_verror_handler(int erno,va_list ap);
 
@@ -11,10 +11,10 @@
 #define LEN_EXP RNX_LEN_EXP
 #define LIM_EXP RNX_LIM_EXP
 
-int rnx_n_exp,*rnx_exp=NULL;
-static int len_exp;
+TH_LOCAL int rnx_n_exp,*rnx_exp=NULL;
+static TH_LOCAL int len_exp;
 
-static int initialized=0;
+static TH_LOCAL int initialized=0;
 void rnx_init(void) {
   if(!initialized) { initialized=1;
     rnx_exp=(int*)m_alloc(len_exp=LEN_EXP,sizeof(int));
@@ -3,10 +3,12 @@
 #ifndef RNX_H
 #define RNX_H 1
 
+#include "th.h"
+
 extern void rnx_init(void);
 extern void rnx_clear(void);
 
-extern int rnx_n_exp,*rnx_exp;
+extern TH_LOCAL int rnx_n_exp,*rnx_exp;
 extern void rnx_expected(int p,int req);
 
 extern char *rnx_p2str(int p);
@@ -3,11 +3,12 @@
 /* validation pipe:
  synopsis
 
-   rvp -qsdevh grammar.rnc
+   rvp -qsmdevh grammar.rnc
 
  reads from 0, writes to 1, 2 for grammar parse errors only, then redirected.
    -q switches to numerical error codes
    -s takes less space but more time
+   -m limits the number of memoized derivatives
    -d plugs in an external type checker
    -e the argument is a Scheme program providing a datatype library
    -v displays version
@@ -15,16 +16,18 @@
  exit code: 0 on valid, non-zero on invalid
 
  protocol
-  query ::= (start | quit | start-tag-open | attribute | start-tag-close | text | end-tag) z.
+  query ::= (start | quit | collect | start-tag-open | attribute | start-tag-close | text | end-tag) z.
    quit ::= "quit".
+   collect ::= "collect" {patno}.
    start ::= "start" [gramno].
    start-tag-open ::= "start-tag-open" patno name.
    attribute ::= "attribute" patno name value.
    start-tag-close :: = "start-tag-close" patno name.
    text ::= ("text"|"mixed") patno text.
    end-tag ::= "end-tag" patno name.
-  response ::= (ok | er | error) z.
+  response ::= (ok | er | error | collected) z.
    ok ::= "ok" patno.
+   collected ::= "ok" {patno}.
    er ::= "er" patno erno.
    error ::= "error" patno erno error.
   z ::= "\0" .
@@ -34,6 +37,9 @@
     -q?er:error
     error==0 yields message 'protocol error' and happens when a query is not understood
     start assumes gramno=0 if the argument is omitted
+    collect lists the patterns still in use; if memory is reclaimed, their numbers
+     change, and the response lists the new numbers in the same order;
+     numbers not listed become invalid
 */
 
 #include <stdlib.h>
@@ -47,28 +53,33 @@
 #include <errno.h>
 #include <assert.h>
 #include "m.h"
+#include "th.h"
 #include "s.h"
 #include "erbit.h"
 #include "drv.h"
+#include "ary.h"
 #include "rnl.h"
 #include "rnv.h"
 #include "dxl.h"
 #include "dsl.h"
 #include "er.h"
 
-extern int rn_notAllowed, drv_compact, rx_compact;
+extern TH_LOCAL int rn_notAllowed;
+extern int drv_compact, rx_compact, rx_lim_m;
 
 #define ATT 0
-#define ENT 1
-#define MIX 2
-#define QUIT 3
-#define START 4
-#define STC 5
-#define STO 6
-#define TXT 7
-#define NKWD 8
+#define COL 1
+#define ENT 2
+#define MIX 3
+#define QUIT 4
+#define START 5
+#define STC 6
+#define STO 7
+#define TXT 8
+#define NKWD 9
 char *kwdtab[NKWD]={
   "attribute",
+  "collect",
   "end-tag",
   "mixed",
   "quit",
@@ -86,6 +97,7 @@ char *kwdtab[NKWD]={
 
 static FILE *nstderr;
 static int explain=1, lasterr, *starts, n_st;
+static int *roots, len_r, n_r; /* starts followed by patterns in use */
 static int len_q,n_q; char *quebuf;
 static int erp[2]; /* *erp to read error messages */
 static jmp_buf IOER;
@@ -156,6 +168,17 @@ static void resp(int ok,int patno,int prevno) {
   buf[0]='\0'; writeall(1,buf,1);
 }
 
+static void resp_collected(void) {
+  int i,len;
+  char buf[LEN_B];
+  writeall(1,"ok",2);
+  for(i=n_st;i!=n_r;++i) {
+    len=sprintf(buf," %u",roots[i]); assert(len<LEN_B);
+    writeall(1,buf,len);
+  }
+  buf[0]='\0'; writeall(1,buf,1);
+}
+
 static int query(void) {
   int i,j,n,dn, kwd, patno,prevno, ok=0;
   char *name;
@@ -180,6 +203,18 @@ static int query(void) {
     if(patno>=n_st) goto PROTER;
     ok=1; patno=starts[patno];
     break;
+  case COL:
+    for(n_r=0;n_r!=n_st;++n_r) roots[n_r]=starts[n_r];
+    for(;;) {
+      j=endtok((i=tok(j))); if(i==j) break;
+      patno=0; do patno=patno*10+quebuf[i++]-'0'; while(i!=j);
+      if(patno==0) goto PROTER;
+      if(n_r==len_r) roots=(int*)m_stretch(roots,len_r=2*n_r,n_r,sizeof(int));
+      roots[n_r++]=patno;
+    }
+    if(drv_collect(roots,n_r)) for(i=0;i!=n_st;++i) starts[i]=roots[i];
+    resp_collected();
+    goto NEXT;
   case STO: case ATT: case STC: case TXT: case MIX: case ENT:
     j=endtok((i=tok(j))); if(i==j) goto PROTER;
     patno=0; do patno=patno*10+quebuf[i++]-'0'; while(i!=j);
@@ -197,7 +232,8 @@ static int query(void) {
       break;
     case TXT: case MIX:
       if(quebuf[j]) ++j; i=j; while(quebuf[j]) ++j;
-      ok=rnv_text(&patno,&prevno,quebuf+i,j-i,kwd==MIX);
+      if(ary_isanyhead(patno)) {prevno=patno; ok=1;} /* any text is allowed and leaves the pattern as is */
+      else ok=rnv_text(&patno,&prevno,quebuf+i,j-i,kwd==MIX);
       break;
     }
     break;
@@ -207,12 +243,13 @@ static int query(void) {
   }
   resp(ok,patno,prevno);
 
+NEXT:
   i=0; while(n!=n_q) quebuf[i++]=quebuf[n++]; n_q=i;
   return 1;
 }
 
 static void version(void) {(*er_printf)("rvp version %s\n",RVP_VERSION);}
-static void usage(void) {(*er_printf)("usage: rvp {-[qs"
+static void usage(void) {(*er_printf)("usage: rvp {-[qsm"
 #if DXL_EXC
 "d"
 #endif
@@ -234,6 +271,7 @@ int main(int argc,char **argv) {
       case 'h': case '?': usage(); return 0;
       case 'v': version(); break;
       case 's': drv_compact=1; rx_compact=1; break;
+      case 'm': drv_compact=1; if(*(argv+1)) drv_lim_m=rx_lim_m=atoi(*(++argv)); goto END_OF_OPTIONS;
 #if DXL_EXC
       case 'd': dxl_cmd=*(argv+1); if(*(argv+1)) ++argv; goto END_OF_OPTIONS;
 #endif
@@ -251,6 +289,7 @@ int main(int argc,char **argv) {
   if(*argv==NULL) {usage(); return 1;}
 
   starts=(int*)m_alloc(argc,sizeof(int));
+  roots=(int*)m_alloc(len_r=2*argc,sizeof(int));
   ok=1; n_st=0;
   do {
     ok=(starts[n_st++]=rnl_fn(*(argv++)))&&ok;
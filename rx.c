@@ -7,6 +7,8 @@
 #include "m.h"
 #include "s.h"
 #include "ht.h"
+#include "cm.h"
+#include "th.h"
 #include "ll.h"
 #include "er.h"
 #include "rx.h"
@@ -14,10 +16,17 @@
 #define LEN_P RX_LEN_P
 #define PRIME_P RX_PRIME_P
 #define LIM_P RX_LIM_P
+#define LEN_M RX_LEN_M
+#define PRIME_M RX_PRIME_M
+#define LIM_M RX_LIM_M
 #define LEN_2 RX_LEN_2
 #define PRIME_2 RX_PRIME_2
 #define LEN_R RX_LEN_R
 #define PRIME_R RX_PRIME_R
+#define LEN_D RX_LEN_D
+#define PRIME_D RX_PRIME_D
+#define LIM_D RX_LIM_D
+#define LEN_BM RX_LEN_BM
 
 #define R_AVG_SIZE 16
 
@@ -33,11 +42,12 @@
 #define P_CLASS 8 /*complement is .-*/
 #define P_ANY 9
 #define P_CHAR 10
+#define P_REPEAT 11 /*p,min,max: min to max times p*/
 
-#define P_SIZE 3
+#define P_SIZE 4
 #define P_AVG_SIZE 2
 
-static int p_size[]={1,1,1,3,3,2,3,3,2,1,2};
+static int p_size[]={1,1,1,3,3,2,3,3,2,1,2,4};
 
 #define P_TYP(i) (pattern[i]&0xF)
 #define P_IS(i,x)  (x==P_TYP(i))
@@ -55,6 +65,7 @@ static int p_size[]={1,1,1,3,3,2,3,3,2,1,2};
 #define Range(p,cf,cl) P_binop(P_RANGE,p,cf,cl)
 #define Class(p,cn) P_unop(P_CLASS,p,cn)
 #define Char(p,c) P_unop(P_CHAR,p,c)
+#define Repeat(p,p1,n,m) P_binop(P_REPEAT,p,p1,n); m=pattern[p+3]
 
 #define P_NUL 0x100
 
@@ -62,18 +73,19 @@ static int p_size[]={1,1,1,3,3,2,3,3,2,1,2};
 #define nullable(p) (pattern[p]&P_NUL)
 
 int rx_compact=0;
+int rx_lim_m=LIM_M;
 /* 'compact' in drv and rx do different things.
  In drv, it limits the size of the table of memoized deltas. In rx, it limits the size
- of the buffer for cached regular expressions; memoized deltas are always limited by LIM_M,
+ of the buffer for cached regular expressions; memoized deltas are always limited by rx_lim_m,
  since the whole repertoire of unicode characters can blow up the buffer.
  */
 
-static char *regex;
-static int *pattern;
-static int (*r2p)[2];
-static struct hashtable ht_r,ht_p,ht_2;
-static int i_p,len_p,i_r,len_r,i_2,len_2;
-static int empty,notAllowed,any;
+static TH_LOCAL char *regex;
+static TH_LOCAL int *pattern;
+static TH_LOCAL int (*r2p)[2];
+static TH_LOCAL struct hashtable ht_r,ht_p,ht_2;
+static TH_LOCAL int i_p,len_p,i_r,len_r,i_2,len_2;
+static TH_LOCAL int empty,notAllowed,any;
 
 static int accept_p(void) {
   int j;
@@ -99,6 +111,7 @@ static int newExcept(int p1,int p2) {P_newbinop(P_EXCEPT,p1,p2); return accept_p
 static int newRange(int cf,int cl) {P_newbinop(P_RANGE,cf,cl); return accept_p();}
 static int newClass(int cn) {P_newunop(P_CLASS,cn); return accept_p();}
 static int newChar(int c) {P_newunop(P_CHAR,c); return accept_p();}
+static int newRepeat(int p1,int n,int m) {P_newbinop(P_REPEAT,p1,n); pattern[i_p+3]=m; setNullable(n==0); return accept_p();}
 
 static int one_or_more(int p) {
   if(P_IS(p,P_EMPTY)) return p;
@@ -114,14 +127,26 @@ static int group(int p1,int p2) {
   return newGroup(p1,p2);
 }
 
+/* long chains of choices are indexed as in rn.c */
 static int samechoice(int p1,int p2) {
-  if(P_IS(p1,P_CHOICE)) {
-    int p11,p12; Choice(p1,p11,p12);
-    return p12==p2||samechoice(p11,p2);
-  } else return p1==p2;
+  int p,p11,p12,c,n=0;
+  if((c=cm_find(CM_RX,p1))!=-1) return cm_has(c,p2);
+  for(p=p1;P_IS(p,P_CHOICE);p=p11) {
+    Choice(p,p11,p12);
+    if(p12==p2) return 1;
+    ++n;
+  }
+  if(p==p2) return 1;
+  if(n>=CM_LIM) {
+    c=cm_new(CM_RX,p1);
+    for(p=p1;P_IS(p,P_CHOICE);p=p11) {Choice(p,p11,p12); cm_add(c,p12);}
+    cm_add(c,p);
+  }
+  return 0;
 }
 
 static int choice(int p1,int p2) {
+  int p,c;
   if(P_IS(p1,P_NOT_ALLOWED)) return p2;
   if(P_IS(p2,P_NOT_ALLOWED)) return p1;
   if(P_IS(p2,P_CHOICE)) {
@@ -131,9 +156,19 @@ static int choice(int p1,int p2) {
   if(samechoice(p1,p2)) return p1;
   if(nullable(p1) && (P_IS(p2,P_EMPTY))) return p1;
   if(nullable(p2) && (P_IS(p1,P_EMPTY))) return p2;
+  if((c=cm_find(CM_RX,p1))!=-1) {cm_add(c,p2); p=newChoice(p1,p2); cm_move(c,p); return p;}
   return newChoice(p1,p2);
 }
 
+/* n to m times p; the counter stays in the node, so that x{1,4000} is one pattern rather than 4000 */
+static int repeat(int p,int n,int m) {
+  if(m==0||P_IS(p,P_EMPTY)) return empty;
+  if(P_IS(p,P_NOT_ALLOWED)) return n==0?empty:p;
+  if(nullable(p)) n=0;
+  if(m==1) return n==0?choice(empty,p):p;
+  return newRepeat(p,n,m);
+}
+
 static int cls(int cn) {
   if(cn<0) return newExcept(any,newClass(-cn));
   if(cn==0) return notAllowed;
@@ -147,8 +182,9 @@ static int equal_p(int p1,int p2) {
   int *pp1=pattern+p1,*pp2=pattern+p2;
   if(P_TYP(p1)!=P_TYP(p2)) return 0;
   switch(p_size[P_TYP(p1)]) {
-  case 3: if(pp1[2]!=pp2[2]) return 0;
-  case 2: if(pp1[1]!=pp2[1]) return 0;
+  case 4: if(pp1[3]!=pp2[3]) return 0; /* fall through */
+  case 3: if(pp1[2]!=pp2[2]) return 0; /* fall through */
+  case 2: if(pp1[1]!=pp2[1]) return 0; /* fall through */
   case 1: return 1;
   default: assert(0);
   }
@@ -160,6 +196,7 @@ static int hash_p(int p) {
   case 1: h=pp[0]&0xF; break;
   case 2: h=(pp[0]&0xF)|(pp[1]<<4); break;
   case 3: h=(pp[0]&0xF)|((pp[1]^pp[2])<<4); break;
+  case 4: h=(pp[0]&0xF)|((pp[1]^pp[2]^pp[3]<<8)<<4); break;
   default: assert(0);
   }
   return h*PRIME_P;
@@ -197,30 +234,28 @@ void rx_default_verror_handler(int erno,va_list ap) {
   }
 }
 
-void (*rx_verror_handler)(int erno,va_list ap)=&rx_default_verror_handler;
+TH_LOCAL void (*rx_verror_handler)(int erno,va_list ap)=&rx_default_verror_handler;
 
 static void error_handler(int erno,...) {
   va_list ap; va_start(ap,erno); (*rx_verror_handler)(erno,ap); va_end(ap);
 }
 
-#define LEN_M RX_LEN_M
-#define PRIME_M RX_PRIME_M
-#define LIM_M RX_LIM_M
 
 #define M_SIZE 3
 
 #define M_SET(p) memo[i_m][M_SIZE-1]=p
 #define M_RET(m) memo[m][M_SIZE-1]
 
-static int (*memo)[M_SIZE];
-static int i_m,len_m;
-static struct hashtable ht_m;
+static TH_LOCAL int (*memo)[M_SIZE];
+static TH_LOCAL int i_m,len_m,n_m,hand_m;
+static TH_LOCAL char *ref_m; /* reference bits for eviction */
+static TH_LOCAL struct hashtable ht_m;
 
 static int new_memo(int p,int c) {
-  int *me=memo[i_m];
-  ht_deli(&ht_m,i_m);
+  int *me=memo[i_m],m;
   me[0]=p; me[1]=c;
-  return ht_get(&ht_m,i_m);
+  if((m=ht_get(&ht_m,i_m))!=-1) ref_m[m]=1;
+  return m;
 }
 
 static int equal_m(int m1,int m2) {
@@ -232,26 +267,70 @@ static int hash_m(int m) {
   return (me[0]^me[1])*PRIME_M;
 }
 
+/* as in drv, the free record is chosen with the clock algorithm once rx_lim_m records are used */
 static void accept_m(void) {
-  if(ht_get(&ht_m,i_m)!=-1) ht_del(&ht_m,i_m);
-  ht_put(&ht_m,i_m++);
-  if(i_m>=LIM_M) i_m=0;
-  if(i_m==len_m) memo=(int(*)[M_SIZE])m_stretch(memo,len_m=i_m*2,i_m,sizeof(int[M_SIZE]));
+  if(ht_get(&ht_m,i_m)!=-1) return;
+  ht_put(&ht_m,i_m); ref_m[i_m]=0;
+  if(n_m>=rx_lim_m) {
+    for(;;) {
+      if(hand_m>=n_m) hand_m=0;
+      if(!ref_m[hand_m]) break;
+      ref_m[hand_m++]=0;
+    }
+    i_m=hand_m++;
+    ht_deli(&ht_m,i_m);
+  } else {
+    i_m=n_m++;
+    if(i_m==len_m) {
+      memo=(int(*)[M_SIZE])m_stretch(memo,len_m=i_m*2,i_m,sizeof(int[M_SIZE]));
+      ref_m=(char*)m_stretch(ref_m,len_m,i_m,sizeof(char));
+    }
+  }
+}
+
+/* patterns reached by the match loops are states of a DFA built as it is run:
+ a state holds the pattern and, for each ASCII character, 0 or the state of the derivative;
+ other characters go through drv and its memo. The states are dropped before a match
+ once there are LIM_D of them. */
+#define D_SIZE (1+0x80)
+
+static TH_LOCAL int (*dfa)[D_SIZE];
+static TH_LOCAL int n_d,len_d;
+static TH_LOCAL struct hashtable ht_d;
+
+static int equal_d(int s1,int s2) {return dfa[s1][0]==dfa[s2][0];}
+static int hash_d(int s) {return dfa[s][0]*PRIME_D;}
+
+static int getD(int p) {
+  int s;
+  dfa[n_d][0]=p;
+  if((s=ht_get(&ht_d,n_d))==-1) {
+    memset(dfa[n_d]+1,0,sizeof(int[0x80]));
+    ht_put(&ht_d,s=n_d++);
+    if(n_d==len_d) dfa=(int(*)[D_SIZE])m_stretch(dfa,len_d=2*n_d,n_d,sizeof(int[D_SIZE]));
+  }
+  return s;
 }
 
+static void clear_d(void) {ht_clear(&ht_d); n_d=1;}
+
 static void windup(void);
-static int initialized=0;
+static TH_LOCAL int initialized=0;
 void rx_init(void) {
   if(!initialized) { initialized=1;
     pattern=(int *)m_alloc(len_p=P_AVG_SIZE*LEN_P,sizeof(int));
     r2p=(int (*)[2])m_alloc(len_2=LEN_2,sizeof(int[2]));
     regex=(char*)m_alloc(len_r=R_AVG_SIZE*LEN_R,sizeof(char));
     memo=(int (*)[M_SIZE])m_alloc(len_m=LEN_M,sizeof(int[M_SIZE]));
+    ref_m=(char*)m_alloc(len_m,sizeof(char));
 
     ht_init(&ht_p,LEN_P,&hash_p,&equal_p);
     ht_init(&ht_2,LEN_2,&hash_2,&equal_2);
     ht_init(&ht_r,LEN_R,&hash_r,&equal_r);
     ht_init(&ht_m,LEN_M,&hash_m,&equal_m);
+    cm_init();
+    dfa=(int(*)[D_SIZE])m_alloc(len_d=LEN_D,sizeof(int[D_SIZE]));
+    ht_init(&ht_d,LEN_D,&hash_d,&equal_d);
 
     windup();
   }
@@ -263,7 +342,8 @@ void rx_clear(void) {
 }
 
 static void windup(void) {
-  i_p=i_r=i_2=i_m=0;
+  cm_clear(CM_RX); clear_d();
+  i_p=i_r=i_2=i_m=0; n_m=1; hand_m=0;
   pattern[0]=P_ERROR;  accept_p();
   empty=newEmpty(); notAllowed=newNotAllowed(); any=newAny();
 }
@@ -273,7 +353,7 @@ static void windup(void) {
 #define SYM_ESC 2
 #define SYM_CHR 3
 
-static int r0,ri,sym,val,errors;
+static TH_LOCAL int r0,ri,sym,val,errors;
 
 static void error(int erno) {
   if(!errors) error_handler(erno,regex+r0,u_strlen(regex+r0)-u_strlen(regex+ri));
@@ -438,21 +518,19 @@ static int number(void) {
 }
 
 static int quantifier(int p0) {
-  int p=empty,n,n0;
-  n=n0=number();
-  while(n--) p=group(p,p0);
+  int n,m;
+  n=m=number();
   if(sym==SYM_CHR) {
     if(val==',') {
       getsym();
       if(sym==SYM_CHR && val=='}') {
-	p=group(p,choice(empty,one_or_more(p0)));
+	return group(repeat(p0,n,n),choice(empty,one_or_more(p0)));
       } else {
-	n=number()-n0; if(n<0) {error(RX_ER_DNUOB); n=0;}
-	while(n--) p=group(p,choice(empty,p0));
+	m=number(); if(m<n) {error(RX_ER_DNUOB); m=n;}
       }
     }
   } else error(RX_ER_NODGT);
-  return p;
+  return repeat(p0,n,m);
 }
 
 static int piece(void) {
@@ -653,6 +731,33 @@ static int in_class(int c,int cn) {
   return 0;
 }
 
+/* membership of characters in the basic plane is looked up in bitmaps of 256-character pages;
+ the bitmap of a page of a class is computed with in_class when the page is first met,
+ and pages that are wholly in or out of the class share no bitmap */
+#define PG_NONE 1
+#define PG_ALL 2
+#define PG_SIZE (0x100/32)
+
+static TH_LOCAL unsigned short *pg[NUM_CLS];
+static TH_LOCAL unsigned (*bm)[PG_SIZE];
+static TH_LOCAL int n_bm,len_bm;
+
+static int newPage(int cn,int page) {
+  unsigned *b; int i,n=0;
+  if(!bm) {bm=(unsigned(*)[PG_SIZE])m_alloc(len_bm=LEN_BM,sizeof(unsigned[PG_SIZE])); n_bm=PG_ALL+1;}
+  if(n_bm==len_bm) bm=(unsigned(*)[PG_SIZE])m_stretch(bm,len_bm=2*n_bm,n_bm,sizeof(unsigned[PG_SIZE]));
+  b=bm[n_bm]; memset(b,0,sizeof(unsigned[PG_SIZE]));
+  for(i=0;i!=0x100;++i) if(in_class(page<<8|i,cn)) {b[i>>5]|=1u<<(i&31); ++n;}
+  return n==0?PG_NONE:n==0x100?PG_ALL:n_bm++;
+}
+
+static int is_class(int c,int cn) {
+  int k;
+  if(c>0xFFFF) return in_class(c,cn);
+  if(!pg[cn]) {pg[cn]=(unsigned short*)m_alloc(0x100,sizeof(unsigned short)); memset(pg[cn],0,0x100*sizeof(unsigned short));}
+  if(!(k=pg[cn][c>>8])) k=pg[cn][c>>8]=newPage(cn,c>>8);
+  return k==PG_NONE?0:k==PG_ALL?1:bm[k][(c>>5)&(PG_SIZE-1)]>>(c&31)&1;
+}
 
 static int drv(int p,int c) {
   int p1,p2,cf,cl,cn,ret,m;
@@ -666,9 +771,10 @@ static int drv(int p,int c) {
   case P_ONE_OR_MORE: OneOrMore(p,p1); ret=group(drv(p1,c),choice(empty,p)); break;
   case P_EXCEPT: Except(p,p1,p2); ret=nullable(drv(p1,c))&&!nullable(drv(p2,c))?empty:notAllowed; break;
   case P_RANGE: Range(p,cf,cl); ret=cf<=c&&c<=cl?empty:notAllowed; break;
-  case P_CLASS: Class(p,cn); ret=in_class(c,cn)?empty:notAllowed; break;
+  case P_CLASS: Class(p,cn); ret=is_class(c,cn)?empty:notAllowed; break;
   case P_ANY: ret=empty; break;
   case P_CHAR: Char(p,cf); ret=c==cf?empty:notAllowed; break;
+  case P_REPEAT: Repeat(p,p1,cf,cl); ret=group(drv(p1,c),repeat(p1,cf==0?0:cf-1,cl-1)); break;
   default: ret=0; assert(0);
   }
   new_memo(p,c); M_SET(ret);
@@ -676,62 +782,98 @@ static int drv(int p,int c) {
   return ret;
 }
 
+/* the derivative of p, in state *s or 0 if the state is not known yet, by u */
+static int delta(int *s,int p,int u) {
+  int t;
+  if(u<0x80) {
+    if(!*s) *s=getD(p);
+    if(!(t=dfa[*s][1+u])) {t=getD(drv(p,u)); dfa[*s][1+u]=t;}
+    *s=t; return dfa[t][0];
+  }
+  *s=0; return drv(p,u);
+}
+
+static int start(char *rx) {
+  if(n_d>=LIM_D) clear_d(); /* state numbers are held only during a match */
+  return compile(rx);
+}
+
+/* follows the known transitions of state *d over ASCII bytes; white space is matched as is (ws=0),
+ as 0x20 (ws=1), or stops the run (ws=2). Returns the position of the first byte not followed */
+static char *run(int *d,int *p,char *s,char *end,int ws) {
+  int t=*d,c;
+  if(!t) return s;
+  for(;s!=end;++s) {
+    if((c=*s)&0x80) break;
+    if(ws&&(c==' '||c=='\t'||c=='\n'||c=='\r')) {if(ws==2) break; c=' ';}
+    if(!dfa[t][1+c]) break;
+    t=dfa[t][1+c];
+  }
+  *d=t; *p=dfa[t][0];
+  return s;
+}
+
+#define getu(u,s) if(*(s)&0x80) s+=u_get(&u,s); else u=*(s)++
+
 int rx_check(char *rx) {(void)compile(rx); return !errors;}
 
 int rx_match(char *rx,char *s,int n) {
-  int p=compile(rx);
+  int p=start(rx),d=0;
   if(!errors) {
     char *end=s+n;
     int u;
     for(;;) {
+      s=run(&d,&p,s,end,0);
       if(p==notAllowed) return 0;
       if(s==end) return nullable(p);
-      s+=u_get(&u,s);
-      p=drv(p,u);
+      getu(u,s);
+      p=delta(&d,p,u);
     }
   } else return 0;
 }
 
 int rx_rmatch(char *rx,char *s,int n) {
-  int p=compile(rx);
+  int p=start(rx),d=0;
   if(!errors) {
     char *end=s+n;
     int u;
     for(;;) {
+      s=run(&d,&p,s,end,1);
       if(p==notAllowed) return 0;
       if(s==end) return nullable(p);
-      s+=u_get(&u,s);
+      getu(u,s);
       if(xmlc_white_space(u)) u=' ';
-      p=drv(p,u);
+      p=delta(&d,p,u);
     }
   } else return 0;
 }
 
 int rx_cmatch(char *rx,char *s,int n) {
-  int p=compile(rx);
+  int p=start(rx),d=0;
   if(!errors) {
     char *end=s+n;
     int u;
     SKIP_SPACE: for(;;) {
       if(s==end) return nullable(p);
-      s+=u_get(&u,s);
+      getu(u,s);
       if(!xmlc_white_space(u)) break;
     }
     for(;;) {
       if(p==notAllowed) return 0;
       if(xmlc_white_space(u)) { u=' ';
-	p=drv(p,u);
+	p=delta(&d,p,u);
 	if(p==notAllowed) {
 	  for(;;) {
 	    if(s==end) return 1;
-	    s+=u_get(&u,s);
+	    getu(u,s);
 	    if(!xmlc_white_space(u)) return 0;
 	  }
 	} else goto SKIP_SPACE;
       }
-      p=drv(p,u);
+      p=delta(&d,p,u);
+      s=run(&d,&p,s,end,2);
       if(s==end) goto SKIP_SPACE;
-      s+=u_get(&u,s);
+      getu(u,s);
     }
   } else return 0;
 }
@@ -1,6 +1,7 @@
 /* $Id$ */
 
 #include <stdarg.h>
+#include "th.h"
 
 #ifndef RX_H
 #define RX_H
@@ -18,8 +19,9 @@
 #define RX_ER_DNUOB 10
 #define RX_ER_NOTRC 11
 
-extern void (*rx_verror_handler)(int erno,va_list ap);
+extern TH_LOCAL void (*rx_verror_handler)(int erno,va_list ap);
 extern int rx_compact;
+extern int rx_lim_m; /* number of memoized derivatives */
 
 extern void rx_default_verror_handler(int erno,va_list ap);
 
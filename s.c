@@ -40,9 +40,9 @@ int s_tokcmpn(char *s1,char *s2,int n2) {
 }
 
 int s_hval(char *s) {
-  int h=0;
+  unsigned h=0;
   while(*s) h=h*31+*(s++);
-  return h;
+  return (int)h;
 }
 
 char *s_clone(char *s) {
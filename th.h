@@ -0,0 +1,34 @@
+/* $Id$ */
+
+#ifndef TH_H
+#define TH_H 1
+
+/* Module state (patterns, memo tables, buffers) is kept in static variables;
+ when TH_THREADS is set, each thread has its own copy of them, and can
+ validate independently of other threads once it has loaded a compiled schema
+ (see rn_save and rn_load in rn.h).
+ The schema itself is not shared: derived patterns are added to the same table
+ as the schema's, so each thread works on its own copy of the tables, which
+ takes about twice the size of the image, plus the hash tables over it.
+ */
+
+#ifndef TH_THREADS
+#define TH_THREADS 0
+#endif
+
+#if TH_THREADS
+#ifdef M_STATIC
+#if M_STATIC
+#error "static memory (M_STATIC) cannot be used with threads (TH_THREADS)"
+#endif
+#endif
+#ifdef _MSC_VER
+#define TH_LOCAL __declspec(thread)
+#else
+#define TH_LOCAL __thread
+#endif
+#else
+#define TH_LOCAL
+#endif
+
+#endif
@@ -0,0 +1,22 @@
+#!/bin/sh
+# $Id$
+# rnv -a must report the same as rnv without it; run by make check in the build directory
+
+d=${srcdir:-.}/tst/d
+tmp=ahead.$$
+status=0
+
+same() {
+  ./rnv "$1" "$2" >$tmp.0 2>&1; s0=$?
+  ./rnv -a "$1" "$2" >$tmp.a 2>&1; sa=$?
+  if [ $s0 != $sa ] || ! cmp -s $tmp.0 $tmp.a; then
+    echo "rnv -a $1 $2 differs from rnv $1 $2:"; diff $tmp.0 $tmp.a; status=1
+  fi
+}
+
+awk -v n=500 -f $d/interleave.awk | sed 's|</configs>|<config><m00/><m00/></config><config><m24/></config></configs>|' >$tmp.xml
+same $d/interleave.rnc $tmp.xml
+same $d/recursive.rnc $d/recursive.xml
+
+rm -f $tmp.*
+exit $status
@@ -16,7 +16,7 @@ int main(int argc,char **argv) {
     ht_put(&ht,i);
     printf("hashtable:");
     for(j=0;j!=ht.tablen;++j) {
-      printf(" (%i,%i)",ht.table[j],ht.table[j|ht.tablen]);
+      if(ht.ctrl[j]&0x80) printf(" (%02x)",ht.ctrl[j]); else printf(" (%i,%i)",ht.table[j],ht.table[j|ht.tablen]);
     }
     printf("\n");
   }
@@ -34,5 +34,12 @@ int main(int argc,char **argv) {
     printf("%i=='%c'?\n",i,ary[ti]);
     assert(i==ht_get(&ht,i));
   }
+  /* deleted slots are reused and the table does not grow */
+  for(j=0;j!=1000;++j) {
+    for(i=0;i!=10;i+=2) ht_put(&ht,i);
+    for(i=0;i!=10;i+=2) assert(ht_deli(&ht,i)==i);
+  }
+  assert(ht.used==5&&ht.tablen==16);
+  for(i=1;i!=11;i+=2) assert(i==ht_get(&ht,i));
   return 0;
 }
@@ -0,0 +1,50 @@
+/* $Id$ */
+/* validates a document read from the standard input against tst/d/recursive.rnc
+ compiled with rnv -C and linked in, without parsing the grammar;
+ usage: schema_test < document.xml */
+#include <stdio.h>
+#include <string.h>
+#include UNISTD_H /*read*/
+#include EXPAT_H
+#include "rn.h"
+#include "rnv.h"
+
+extern int rn_schema_recursive(void);
+
+static int current,previous,ok=1,mixed=0;
+static char text[1024]; static int n_txt=0;
+
+static void flush_text(void) {
+  ok=rnv_text(&current,&previous,text,n_txt,mixed)&&ok;
+  text[n_txt=0]='\0';
+}
+
+static void start_element(void *userData,const char *name,const char **attrs) {
+  mixed=1; flush_text(); mixed=0;
+  ok=rnv_start_tag(&current,&previous,(char*)name,(char**)attrs)&&ok;
+}
+
+static void end_element(void *userData,const char *name) {
+  flush_text(); mixed=1;
+  ok=rnv_end_tag(&current,&previous,(char*)name)&&ok;
+}
+
+static void characters(void *userData,const char *s,int len) {
+  if(n_txt+len>=(int)sizeof(text)) len=sizeof(text)-1-n_txt;
+  memcpy(text+n_txt,s,len); text[n_txt+=len]='\0';
+}
+
+int main(int argc,char **argv) {
+  XML_Parser expat; char buf[1024]; int len;
+  previous=current=rn_schema_recursive();
+  rnv_init();
+  expat=XML_ParserCreateNS(NULL,':');
+  XML_SetElementHandler(expat,&start_element,&end_element);
+  XML_SetCharacterDataHandler(expat,&characters);
+  do {
+    if((len=read(0,buf,sizeof(buf)))<0||!XML_Parse(expat,buf,len,len==0)) {ok=0; break;}
+  } while(len!=0);
+  XML_ParserFree(expat);
+  fprintf(stderr,"%s\n",ok?"ok":"error");
+  return !ok;
+}
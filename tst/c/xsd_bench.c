@@ -0,0 +1,45 @@
+/* $Id$ */
+/* times xsd_allows on values of the built-in types, which are checked with the PAT_* expressions in xsd.c;
+ usage: xsd_bench [repetitions] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "xsd.h"
+
+static char *values[][2]={
+  {"decimal","-1234.5678"},
+  {"integer","+1234567890"},
+  {"nonNegativeInteger","1234567890"},
+  {"double","-1.25E-3"},
+  {"hexBinary","0123456789abcdefABCDEF"},
+  {"base64Binary","YmFzZTY0IGVuY29kZWQgdGV4dA=="},
+  {"anyURI","http://www.example.com/a/b/c?x=1&y=2#top"},
+  {"NCName","element-name_01"},
+  {"QName","xsd:element-name"},
+  {"NMTOKENS","token1 token2 token3"},
+  {"language","en-US"},
+  {"duration","P1Y2M3DT10H30M12.5S"},
+  {"dateTime","2002-10-10T12:00:00.5-05:00"},
+  {"date","2002-10-10Z"},
+  {"time","13:20:00+01:00"},
+  {"gYearMonth","2002-10"},
+  {"token","  a  collapsed   token  "},
+  {"NCName","\xc3\xa9l\xc3\xa9ment"},
+  {NULL,NULL}
+};
+
+int main(int argc,char **argv) {
+  int n=argc>1?atoi(argv[1]):100000,i,k,ok;
+  clock_t t;
+  xsd_init();
+  for(i=0;values[i][0];++i) {
+    char *typ=values[i][0],*s=values[i][1];
+    ok=xsd_allows(typ,"",s,strlen(s));
+    t=clock();
+    for(k=0;k!=n;++k) xsd_allows(typ,"",s,strlen(s));
+    printf("%-20s %-40s %s %8.1f ns\n",typ,s,ok?"ok   ":"error",
+      (double)(clock()-t)/CLOCKS_PER_SEC*1e9/n);
+  }
+  return 0;
+}
@@ -0,0 +1,13 @@
+#!/bin/sh
+# $Id$
+# the grammar written by rnv -C is compiled into schematest, which must accept
+# a valid document and reject an invalid one; rnv -C must refuse documents
+
+d=${srcdir:-.}/tst/d
+status=0
+
+./schematest <$d/recursive-valid.xml || { echo "schematest rejects recursive-valid.xml"; status=1; }
+./schematest <$d/recursive.xml && { echo "schematest accepts recursive.xml"; status=1; }
+./rnv -C $d/recursive.rnc $d/recursive.xml >/dev/null && { echo "rnv -C accepts a document"; status=1; }
+
+exit $status
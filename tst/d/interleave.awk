@@ -0,0 +1,17 @@
+# writes a document for interleave.rnc: n records (50000 by default),
+# each with a random subset of the 24 members in random order
+# usage: awk -v n=1000 -f interleave.awk | rnv interleave.rnc
+BEGIN {
+  if(!n) n=50000;
+  srand(1);
+  printf("<configs>\n");
+  for(r=0;r!=n;++r) {
+    for(i=0;i!=24;++i) m[i]=i;
+    for(i=23;i>0;--i) {j=int(rand()*(i+1)); t=m[i]; m[i]=m[j]; m[j]=t;}
+    k=12+int(rand()*13);
+    printf("<config>");
+    for(i=0;i!=k;++i) printf("<m%02d>v</m%02d>",m[i],m[i]);
+    printf("</config>\n");
+  }
+  printf("</configs>\n");
+}
@@ -0,0 +1,51 @@
+#!/bin/sh
+# $Id$
+# rnv -f must report the same as rnv without it when the image is fresh, truncated,
+# corrupt, older than a grammar rewritten with the same size and time, or written by concurrent runs
+
+d=${srcdir:-.}/tst/d
+tmp=image.$$
+status=0
+
+mkdir $tmp
+cp $d/recursive.rnc $tmp/g.rnc
+./rnv $tmp/g.rnc $d/recursive.xml >$tmp/ref 2>&1
+
+same() {
+  ./rnv -f $tmp/g.img $tmp/g.rnc $d/recursive.xml >$tmp/out 2>&1
+  cmp -s $tmp/ref $tmp/out || { echo "rnv -f: $1"; diff $tmp/ref $tmp/out; status=1; }
+}
+
+# overwrites the int at offset $1 of a fresh image with 0x7fffffff, counted from the end if negative
+poke() {
+  rm -f $tmp/g.img; same "writing the image"
+  i=$1; [ $i -lt 0 ] && i=$(($i+`wc -c <$tmp/g.img`/4))
+  printf '\377\377\377\177' | dd of=$tmp/g.img bs=4 seek=$i conv=notrunc 2>/dev/null
+  same "$2"
+}
+
+rm -f $tmp/g.img; same "writing the image"
+same "loading the image"
+head -c 100 $tmp/g.img >$tmp/t; mv $tmp/t $tmp/g.img
+same "truncated image"
+poke 2 "start pattern out of range"
+poke 3 "pattern table longer than the image"
+poke 20 "corrupt pattern table"
+poke -8 "corrupt string table"
+
+rm -f $tmp/g.img; same "writing the image"
+touch -r $tmp/g.rnc $tmp/stamp
+sed 's/element emph/element bold/' $d/recursive.rnc >$tmp/g.rnc
+touch -r $tmp/stamp $tmp/g.rnc
+./rnv $tmp/g.rnc $d/recursive.xml >$tmp/ref 2>&1
+same "grammar changed without changing its size and time"
+
+rm -f $tmp/g.img
+for i in 1 2 3 4 5 6 7 8; do ./rnv -f $tmp/g.img $tmp/g.rnc $d/recursive.xml >$tmp/out.$i 2>&1 & done
+wait
+for i in 1 2 3 4 5 6 7 8; do cmp -s $tmp/ref $tmp/out.$i || { echo "rnv -f: concurrent writer $i"; status=1; }; done
+same "image written by concurrent writers"
+[ `ls $tmp | grep -c '^g\.img.'` -eq 0 ] || { echo "rnv -f: temporary files left"; status=1; }
+
+rm -rf $tmp
+exit $status
@@ -19,6 +19,8 @@ done
 
 rnv ${FLAGS} -c tst/g/paths.rnc
 
+awk -f ${RNVDIR}/tst/d/interleave.awk | (time rnv ${FLAGS} ${RNVDIR}/tst/d/interleave.rnc)
+
 rnv ${FLAGS} ${HOME}/Docu/RELAX-NG/testSuite/testSuite.rnc \
     ${HOME}/Docu/RELAX-NG/testSuite/spectest.xml
 rnv ${FLAGS} ${RNDIR}/docbook.rnc ${HOME}/work/XEP/doc/docbook/*.dbx
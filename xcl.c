@@ -8,11 +8,18 @@
 #include <string.h> /*strerror*/
 #include <errno.h>
 #include <assert.h>
+#include <stdio.h> /*printf,vsnprintf*/
 #include EXPAT_H
 #include "m.h"
+#include "th.h"
+#if TH_THREADS
+#include <pthread.h>
+#endif
+#include "rn.h"
 #include "s.h"
 #include "erbit.h"
 #include "drv.h"
+#include "ary.h"
 #include "rnl.h"
 #include "rnv.h"
 #include "rnx.h"
@@ -21,10 +28,13 @@
 #include "dsl.h"
 #include "er.h"
 
-extern int rn_notAllowed,rx_compact,drv_compact;
+extern int rx_compact,rx_lim_m,drv_compact;
 
 #define LEN_T XCL_LEN_T
 #define LIM_T XCL_LIM_T
+#define LEN_O XCL_LEN_O
+#define LEN_K XCL_LEN_K
+#define LIM_K XCL_LIM_K
 
 #define BUFSIZE 1024
 
@@ -38,18 +48,22 @@ extern int rn_notAllowed,rx_compact,drv_compact;
 #define PIXGFILE "davidashen-net-xg-file"
 #define PIXGPOS "davidashen-net-xg-pos"
 
-static int peipe,verbose,nexp,rnck;
-static char *xml;
-static XML_Parser expat=NULL;
-static int start,current,previous;
-static int mixed=0;
-static int lastline,lastcol,level;
-static char *xgfile=NULL,*xgpos=NULL;
-static int ok;
+static int peipe,verbose,nexp,rnck,jobs,scm,stats,kstack,ahead,csrc;
+static int n_sto,n_sto_hit,n_val,n_val_hit;
+static TH_LOCAL char *xml;
+static TH_LOCAL XML_Parser expat=NULL;
+static TH_LOCAL int start,current,previous; /* renumbered when patterns are collected */
+static TH_LOCAL int mixed=0;
+static TH_LOCAL int lastline,lastcol,level,skip;
+static TH_LOCAL char *xgfile=NULL,*xgpos=NULL;
+static TH_LOCAL int ok;
+/* with -k, the continuation of each open element is kept in kst instead of in After patterns,
+ and current is the element's content; 0 marks an element whose start tag derivative is not After */
+static TH_LOCAL int *kst,len_kst,n_kst;
 
 /* Expat does not normalize strings on input */
-static char *text; static int len_txt;
-static int n_txt;
+static TH_LOCAL char *text; static TH_LOCAL int len_txt;
+static TH_LOCAL int n_txt;
 
 #define err(msg) (*er_vprintf)(msg"\n",ap);
 static void verror_handler(int erno,va_list ap) {
@@ -63,8 +77,10 @@ static void verror_handler(int erno,va_list ap) {
       if(erno&ERBIT_RNV) {
 	rnv_default_verror_handler(erno&~ERBIT_RNV,ap);
 	if(nexp) { int req=2, i=0; char *s;
+	  int p=previous;
+	  if(n_kst&&kst[n_kst-1]) p=rn_after(p,kst[n_kst-1]); /* expected as with After patterns */
 	  while(req--) {
-	    rnx_expected(previous,req);
+	    rnx_expected(p,req);
 	    if(i==rnx_n_exp) continue;
 	    if(rnx_n_exp>nexp) break;
 	    (*er_printf)((char*)(req?"required:\n":"allowed:\n"));
@@ -90,27 +106,35 @@ static void verror_handler_rnl(int erno,va_list ap) {verror_handler(erno|ERBIT_R
 static void verror_handler_rnv(int erno,va_list ap) {verror_handler(erno|ERBIT_RNV,ap);}
 
 static void windup(void);
-static int initialized=0;
+static void init_validator(void) {
+  rnv_init(); rnv_verror_handler=&verror_handler_rnv;
+  rnx_init();
+  drv_add_dtl(DXL_URL,&dxl_equal,&dxl_allows);
+  drv_add_dtl(DSL_URL,&dsl_equal,&dsl_allows);
+  text=(char*)m_alloc(len_txt=LEN_T,sizeof(char));
+  kst=(int*)m_alloc(len_kst=LEN_K,sizeof(int));
+  windup();
+}
+
+/* the validator is initialized once the grammar is loaded, see rn_load */
+static TH_LOCAL int initialized=0;
 static void init(void) {
   if(!initialized) {initialized=1;
     rnl_init(); rnl_verror_handler=&verror_handler_rnl;
-    rnv_init(); rnv_verror_handler=&verror_handler_rnv;
-    rnx_init();
-    drv_add_dtl(DXL_URL,&dxl_equal,&dxl_allows);
-    drv_add_dtl(DSL_URL,&dsl_equal,&dsl_allows);
-    text=(char*)m_alloc(len_txt=LEN_T,sizeof(char));
-    windup();
   }
 }
 
 static void clear(void) {
   if(len_txt>LIM_T) {m_free(text); text=(char*)m_alloc(len_txt=LEN_T,sizeof(char));}
+  if(len_kst>LIM_K) {m_free(kst); kst=(int*)m_alloc(len_kst=LEN_K,sizeof(int));}
+  if(drv_collect(&start,1)) previous=current=start;
   windup();
 }
 
 static void windup(void) {
   text[n_txt=0]='\0';
-  level=0; lastline=lastcol=-1;
+  level=0; skip=0; lastline=lastcol=-1;
+  n_kst=0;
 }
 
 static void error_handler(int erno,...) {
@@ -122,21 +146,45 @@ static void flush_text(void) {
   text[n_txt=0]='\0';
 }
 
+/* the content of an element that allows any content is not validated;
+ skip counts the open elements, and the continuation becomes current at once */
 static void start_element(void *userData,const char *name,const char **attrs) {
-  if(current!=rn_notAllowed) {
+  if(skip) {
+    ++skip;
+  } else if(current!=rn_notAllowed) {
     mixed=1;
     flush_text();
     ok=rnv_start_tag(&current,&previous,(char*)name,(char**)attrs)&&ok;
     mixed=0;
+    if(ary_isanyhead(current)) {
+      previous=current; current=rn_pattern[previous+2];
+      skip=1;
+    } else if(kstack&&current!=rn_notAllowed) {
+      int p1=0,p2=0;
+      if(RN_P_IS(current,RN_P_AFTER)) {rn_After(current,p1,p2); current=p1;}
+      if(n_kst==len_kst) kst=(int*)m_stretch(kst,len_kst=2*n_kst,n_kst,sizeof(int));
+      kst[n_kst++]=p2;
+    }
   } else {
     ++level;
   }
 }
 
 static void end_element(void *userData,const char *name) {
-  if(current!=rn_notAllowed) {
+  if(skip) {
+    if(--skip==0) mixed=1;
+  } else if(current!=rn_notAllowed) {
     flush_text();
-    ok=rnv_end_tag(&current,&previous,(char*)name)&&ok;
+    if(kstack&&n_kst&&kst[n_kst-1]) {
+      int k=kst[--n_kst];
+      if(rn_nullable(current)) {previous=current; current=k;} else {
+	current=rn_after(current,k);
+	ok=rnv_end_tag(&current,&previous,(char*)name)&&ok;
+      }
+    } else {
+      if(kstack&&n_kst) --n_kst;
+      ok=rnv_end_tag(&current,&previous,(char*)name)&&ok;
+    }
     mixed=1;
   } else {
     if(level==0) current=previous; else --level;
@@ -144,7 +192,7 @@ static void end_element(void *userData,const char *name) {
 }
 
 static void characters(void *userData,const char *s,int len) {
-  if(current!=rn_notAllowed) {
+  if(!skip&&current!=rn_notAllowed) {
     int newlen_txt=n_txt+len+1;
     if(newlen_txt<=LIM_T&&LIM_T<len_txt) newlen_txt=LIM_T;
     else if(newlen_txt<len_txt) newlen_txt=len_txt;
@@ -213,8 +261,147 @@ static void validate(int fd) {
   XML_ParserFree(expat);
 }
 
+static void check(char *fn) {
+  int fd; xml=fn;
+  if((fd=open(xml,O_RDONLY))==-1) {
+    (*er_printf)("I/O error (%s): %s\n",xml,strerror(errno));
+    ok=0;
+    return;
+  }
+  if(verbose) (*er_printf)("%s\n",xml);
+  validate(fd);
+  close(fd);
+  clear();
+}
+
+#if TH_THREADS
+/* each worker loads its own copy of the schema and validates documents
+ taken in turn from the list; messages are collected per document and
+ printed in the order of the arguments */
+
+static struct rn_schema schema;
+static char **docs; static int n_docs,i_doc,i_out,jobs_ok;
+static struct out {char *s; int n; int done;} *outs;
+static pthread_mutex_t jobs_mutex=PTHREAD_MUTEX_INITIALIZER;
+static int (*er_vprintf_0)(char *format,va_list ap);
+
+static TH_LOCAL char *obuf=NULL; static TH_LOCAL int len_obuf,n_obuf;
+
+static int vprintf_job(char *format,va_list ap) {
+  va_list aq; int n;
+  if(!obuf) return (*er_vprintf_0)(format,ap);
+  va_copy(aq,ap); n=vsnprintf(obuf+n_obuf,len_obuf-n_obuf,format,aq); va_end(aq);
+  if(n<0) return n;
+  if(n_obuf+n>=len_obuf) {
+    obuf=(char*)m_stretch(obuf,len_obuf=2*(n_obuf+n+1),n_obuf,sizeof(char));
+    vsnprintf(obuf+n_obuf,len_obuf-n_obuf,format,ap);
+  }
+  n_obuf+=n;
+  return n;
+}
+
+static int printf_0(char *format,...) {
+  int ret;
+  va_list ap; va_start(ap,format); ret=(*er_vprintf_0)(format,ap); va_end(ap);
+  return ret;
+}
+
+static void *worker(void *arg) {
+  int i;
+  rn_load(&schema); init_validator(); start=*(int*)arg;
+  if(ahead) drv_explore(start);
+  for(;;) {
+    pthread_mutex_lock(&jobs_mutex); i=i_doc++; pthread_mutex_unlock(&jobs_mutex);
+    if(i>=n_docs) break;
+    obuf=(char*)m_alloc(len_obuf=LEN_O,sizeof(char)); obuf[n_obuf=0]='\0';
+    ok=1;
+    check(docs[i]);
+    pthread_mutex_lock(&jobs_mutex);
+    outs[i].s=obuf; outs[i].n=n_obuf; outs[i].done=1; obuf=NULL;
+    jobs_ok=jobs_ok&&ok;
+    while(i_out!=n_docs&&outs[i_out].done) {
+      if(outs[i_out].n) printf_0("%s",outs[i_out].s);
+      m_free(outs[i_out].s); ++i_out;
+    }
+    pthread_mutex_unlock(&jobs_mutex);
+  }
+  pthread_mutex_lock(&jobs_mutex);
+  n_sto+=drv_n_sto; n_sto_hit+=drv_n_sto_hit;
+  n_val+=drv_n_txt; n_val_hit+=drv_n_txt_hit;
+  pthread_mutex_unlock(&jobs_mutex);
+  return NULL;
+}
+
+static int check_jobs(char **argv) {
+  pthread_t *tids; int i,n_tids,e;
+  rn_save(&schema);
+  for(n_docs=0;argv[n_docs];++n_docs);
+  docs=argv; i_doc=i_out=0; jobs_ok=1;
+  outs=(struct out*)m_alloc(n_docs,sizeof(struct out));
+  for(i=0;i!=n_docs;++i) outs[i].done=0;
+  er_vprintf_0=er_vprintf; er_vprintf=&vprintf_job;
+  n_tids=jobs<n_docs?jobs:n_docs;
+  tids=(pthread_t*)m_alloc(n_tids,sizeof(pthread_t));
+  for(i=0;i!=n_tids;++i) {
+    if((e=pthread_create(tids+i,NULL,&worker,&start))!=0) {
+      (*er_printf)("error: cannot create thread: %s\n",strerror(e));
+      break;
+    }
+  }
+  n_tids=i;
+  for(i=0;i!=n_tids;++i) pthread_join(tids[i],NULL);
+  er_vprintf=er_vprintf_0;
+  if(n_tids==0) {ok=1; do check(*argv); while(*(++argv)); jobs_ok=ok;}
+  m_free(tids); m_free(outs);
+  return jobs_ok;
+}
+#endif
+
+static void statistics(void) {
+  n_sto+=drv_n_sto; n_sto_hit+=drv_n_sto_hit;
+  n_val+=drv_n_txt; n_val_hit+=drv_n_txt_hit;
+  (*er_printf)("start tags: %i, cached transitions: %i (%i%%)\n",
+    n_sto,n_sto_hit,n_sto?(int)(100.0*n_sto_hit/n_sto):0);
+  (*er_printf)("short values: %i, cached values: %i (%i%%)\n",
+    n_val,n_val_hit,n_val?(int)(100.0*n_val_hit/n_val):0);
+}
+
+static void emit_ints(char *name,const int *a,int n) {
+  int i;
+  printf("static const int %s[%i]={",name,n);
+  for(i=0;i!=n;++i) printf(i%16?",%i":i?",\n%i":"\n%i",a[i]);
+  printf("\n};\n\n");
+}
+
+/* writes the compiled schema as C source: the tables and a function that loads them
+ with rn_load and returns the start pattern, named after the schema file */
+static void emit(char *fn) {
+  struct rn_schema sc; char *name,*s; int i;
+  rn_save(&sc);
+  name=s_clone((s=strrchr(fn,'/'))?s+1:fn);
+  for(s=name;*s;++s) {
+    if(*s=='.') {*s='\0'; break;}
+    if(!(('a'<=*s&&*s<='z')||('A'<=*s&&*s<='Z')||('0'<=*s&&*s<='9'))) *s='_';
+  }
+  printf("/* generated by rnv -C from %s */\n\n#include \"rn.h\"\n\n",fn);
+  emit_ints("pattern",sc.pattern,sc.n_p);
+  emit_ints("nameclass",sc.nameclass,sc.n_nc);
+  printf("static const char string[%i]=",sc.n_s);
+  for(i=0;i!=sc.n_s;++i) {
+    unsigned char c=(unsigned char)sc.string[i];
+    if(i==0||sc.string[i-1]=='\0') printf("\n\"");
+    if(c<0x20||c>=0x7f||c=='"'||c=='\\'||c=='?') printf("\\%03o",c); else putchar(c);
+    if(c=='\0') putchar('"');
+  }
+  printf(";\n\nstatic const struct rn_schema schema={pattern,nameclass,string,%i,%i,%i};\n\n",sc.n_p,sc.n_nc,sc.n_s);
+  printf("int rn_schema_%s(void) {rn_load(&schema); return %i;}\n",name,start);
+  m_free(name);
+  m_free((int*)sc.pattern); m_free((int*)sc.nameclass); m_free((char*)sc.string);
+}
+
 static void version(void) {(*er_printf)("rnv version %s\n",RNV_VERSION);}
-static void usage(void) {(*er_printf)("usage: rnv {-[qnspc"
+static void usage(void) {(*er_printf)("usage: rnv {-[qnspcm"
+"jtkaCf"
 #if DXL_EXC
 "d"
 #endif
@@ -226,7 +413,7 @@ static void usage(void) {(*er_printf)("usage: rnv {-[qnspc"
 int main(int argc,char **argv) {
   init();
 
-  peipe=0; verbose=1; nexp=NEXP; rnck=0;
+  peipe=0; verbose=1; nexp=NEXP; rnck=0; jobs=1; scm=0; stats=0; kstack=0; ahead=0; csrc=0;
   while(*(++argv)&&**argv=='-') {
     int i=1;
     for(;;) {
@@ -235,13 +422,20 @@ int main(int argc,char **argv) {
       case 'q': verbose=0; nexp=0; break;
       case 'n': if(*(argv+1)) nexp=atoi(*(++argv)); goto END_OF_OPTIONS;
       case 's': drv_compact=1; rx_compact=1; break;
+      case 'm': drv_compact=1; if(*(argv+1)) drv_lim_m=rx_lim_m=atoi(*(++argv)); goto END_OF_OPTIONS;
       case 'p': peipe=1; break;
       case 'c': rnck=1; break;
+      case 't': stats=1; break;
+      case 'k': kstack=1; break;
+      case 'a': kstack=1; ahead=1; break;
+      case 'C': csrc=1; break;
+      case 'f': rnl_image=*(argv+1); if(*(argv+1)) ++argv; goto END_OF_OPTIONS;
+      case 'j': if(*(argv+1)) jobs=atoi(*(++argv)); goto END_OF_OPTIONS;
 #if DXL_EXC
       case 'd': dxl_cmd=*(argv+1); if(*(argv+1)) ++argv; goto END_OF_OPTIONS;
 #endif
 #if DSL_SCM
-      case 'e': dsl_ld(*(argv+1)); if(*(argv+1)) ++argv; goto END_OF_OPTIONS;
+      case 'e': scm=1; dsl_ld(*(argv+1)); if(*(argv+1)) ++argv; goto END_OF_OPTIONS;
 #endif
       case 'v': version(); break;
       case 'h': case '?': usage(); return 1;
@@ -253,21 +447,18 @@ int main(int argc,char **argv) {
   }
 
   if(!*(argv)) {usage(); return 1;}
+  if(csrc&&*(argv+1)) {(*er_printf)("error: -C writes the grammar and validates no documents\n"); return EXIT_FAILURE;}
 
   if((ok=start=rnl_fn(*(argv++)))) {
+    init_validator();
+    if(csrc) emit(*(argv-1)); else
     if(*argv) {
-      do {
-	int fd; xml=*argv;
-	if((fd=open(xml,O_RDONLY))==-1) {
-	  (*er_printf)("I/O error (%s): %s\n",xml,strerror(errno));
-	  ok=0;
-	  continue;
-	}
-	if(verbose) (*er_printf)("%s\n",xml);
-	validate(fd);
-	close(fd);
-	clear();
-      } while(*(++argv));
+      if(ahead) drv_explore(start);
+#if TH_THREADS
+      /* copying input to output and Scheme datatypes are not thread-safe */
+      if(jobs>1&&*(argv+1)&&!peipe&&!scm) ok=check_jobs(argv); else
+#endif
+      do check(*argv); while(*(++argv));
       if(!ok&&verbose) (*er_printf)("error: some documents are invalid\n");
     } else {
       if(!rnck) {
@@ -279,5 +470,6 @@ int main(int argc,char **argv) {
     }
   }
 
+  if(stats) statistics();
   return ok?EXIT_SUCCESS:EXIT_FAILURE;
 }
@@ -10,6 +10,7 @@
 #include "s.h"
 #include "erbit.h"
 #include "rx.h"
+#include "th.h"
 #include "xsd_tm.h"
 #include "er.h"
 #include "xsd.h"
@@ -33,7 +34,7 @@ void xsd_default_verror_handler(int erno,va_list ap) {
   }
 }
 
-void (*xsd_verror_handler)(int erno,va_list ap)=&xsd_default_verror_handler;
+TH_LOCAL void (*xsd_verror_handler)(int erno,va_list ap)=&xsd_default_verror_handler;
 
 static void error_handler(int erno,...) {
   va_list ap; va_start(ap,erno); (*xsd_verror_handler)(erno,ap); va_end(ap);
@@ -42,7 +43,7 @@ static void error_handler(int erno,...) {
 static void verror_handler_rx(int erno,va_list ap) {(*xsd_verror_handler)(erno|ERBIT_RX,ap);}
 
 static void windup(void);
-static int initialized=0;
+static TH_LOCAL int initialized=0;
 void xsd_init(void) {
   if(!initialized) { initialized=1;
     rx_init(); rx_verror_handler=&verror_handler_rx;
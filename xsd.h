@@ -1,6 +1,7 @@
 /* $Id$ */
 
 #include <stdarg.h>
+#include "th.h"
 
 #ifndef XSD_H
 #define XSD_H 1
@@ -13,7 +14,7 @@
 #define XSD_ER_WS 5
 #define XSD_ER_ENUM 6
 
-extern void (*xsd_verror_handler)(int erno,va_list ap);
+extern TH_LOCAL void (*xsd_verror_handler)(int erno,va_list ap);
 
 extern void xsd_default_verror_handler(int erno,va_list ap);
 